@@ -29,6 +29,9 @@
  * every time a temperature conversion is required. However this can result in the
  * cached value becoming inconsistent with the hardware value, so care must be taken.
  *
+ * The alarm triggers are cached alongside the resolution once they have been read with
+ * CRC checking enabled, so that an unchanged configuration is never rewritten.
+ *
  */
 
 #include <stddef.h>
@@ -50,6 +53,7 @@
 
 static const char * TAG = "ds18b20";
 static const int T_CONV = 750;   // maximum conversion time at 12-bit resolution in milliseconds
+static const int T_COPY = 10;    // maximum scratchpad to EEPROM copy time in milliseconds
 
 // Function commands
 #define DS18B20_FUNCTION_TEMP_CONVERT       0x44  ///< Initiate a single temperature conversion
@@ -71,6 +75,10 @@ typedef struct
 } __attribute__((packed)) Scratchpad;
 /// @endcond ignore
 
+static DS18B20_Info _pool[DS18B20_POOL_SIZE];
+static bool _pool_used[DS18B20_POOL_SIZE];
+static portMUX_TYPE _pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
 static void _init(DS18B20_Info * ds18b20_info, const OneWireBus * bus)
 {
     if (ds18b20_info != NULL)
@@ -80,6 +88,10 @@ static void _init(DS18B20_Info * ds18b20_info, const OneWireBus * bus)
         ds18b20_info->use_crc = false;
         ds18b20_info->resolution = DS18B20_RESOLUTION_INVALID;
         ds18b20_info->solo = false;   // assume multiple devices unless told otherwise
+        ds18b20_info->config_cached = false;
+        ds18b20_info->config_dirty = false;
+        ds18b20_info->trigger_high = 0;
+        ds18b20_info->trigger_low = 0;
         ds18b20_info->init = true;
     }
     else
@@ -145,6 +157,23 @@ static bool _check_resolution(DS18B20_RESOLUTION resolution)
     return (resolution >= DS18B20_RESOLUTION_9_BIT) && (resolution <= DS18B20_RESOLUTION_12_BIT);
 }
 
+static uint8_t _encode_configuration(DS18B20_RESOLUTION resolution)
+{
+    return (((resolution - 1) & 0x03) << 5) | 0x1f;
+}
+
+static DS18B20_RESOLUTION _decode_configuration(uint8_t configuration)
+{
+    return ((configuration >> 5) & 0x03) + DS18B20_RESOLUTION_9_BIT;
+}
+
+static bool _config_matches(const DS18B20_Info * ds18b20_info, const DS18B20_Config * config)
+{
+    return ds18b20_info->resolution == config->resolution
+        && ds18b20_info->trigger_high == config->trigger_high
+        && ds18b20_info->trigger_low == config->trigger_low;
+}
+
 static float _wait_for_duration(DS18B20_RESOLUTION resolution)
 {
     int64_t start_time = esp_timer_get_time();
@@ -199,22 +228,26 @@ static float _wait_for_device_signal(const DS18B20_Info * ds18b20_info)
     return elapsed_time;
 }
 
-static float _decode_temp(uint8_t lsb, uint8_t msb, DS18B20_RESOLUTION resolution)
+static int16_t _decode_raw(uint8_t lsb, uint8_t msb, DS18B20_RESOLUTION resolution)
 {
-    float result = 0.0f;
+    int16_t raw = 0;
     if (_check_resolution(resolution))
     {
         // masks to remove undefined bits from result
         static const uint8_t lsb_mask[4] = { ~0x07, ~0x03, ~0x01, ~0x00 };
         uint8_t lsb_masked = lsb_mask[resolution - DS18B20_RESOLUTION_9_BIT] & lsb;
-        int16_t raw = (msb << 8) | lsb_masked;
-        result = raw / 16.0f;
+        raw = (msb << 8) | lsb_masked;
     }
     else
     {
         ESP_LOGE(TAG, "Unsupported resolution %d", resolution);
     }
-    return result;
+    return raw;
+}
+
+static float _decode_temp(uint8_t lsb, uint8_t msb, DS18B20_RESOLUTION resolution)
+{
+    return _decode_raw(lsb, msb, resolution) / 16.0f;
 }
 
 static size_t _min(size_t x, size_t y)
@@ -331,6 +364,23 @@ static bool _write_scratchpad(const DS18B20_Info * ds18b20_info, const Scratchpa
     return result;
 }
 
+static bool _copy_scratchpad(const DS18B20_Info * ds18b20_info)
+{
+    bool result = false;
+    if (_address_device(ds18b20_info))
+    {
+        ESP_LOGD(TAG, "scratchpad copy to EEPROM");
+        owb_write_byte(ds18b20_info->bus, DS18B20_FUNCTION_SCRATCHPAD_COPY);
+
+        // parasitic-powered devices need the strong pull-up for the whole EEPROM write
+        owb_set_strong_pullup(ds18b20_info->bus, true);
+        // the first tick may be nearly over already, so wait one more
+        vTaskDelay(pdMS_TO_TICKS(T_COPY) + 1);
+        owb_set_strong_pullup(ds18b20_info->bus, false);
+        result = true;
+    }
+    return result;
+}
 
 // Public API
 
@@ -360,6 +410,66 @@ void ds18b20_free(DS18B20_Info ** ds18b20_info)
     }
 }
 
+DS18B20_Info * ds18b20_pool_alloc(void)
+{
+    DS18B20_Info * ds18b20_info = NULL;
+    portENTER_CRITICAL(&_pool_lock);
+    for (size_t i = 0; i < DS18B20_POOL_SIZE; ++i)
+    {
+        if (!_pool_used[i])
+        {
+            _pool_used[i] = true;
+            ds18b20_info = &_pool[i];
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&_pool_lock);
+
+    if (ds18b20_info != NULL)
+    {
+        memset(ds18b20_info, 0, sizeof(*ds18b20_info));
+        ESP_LOGD(TAG, "pool alloc %p", ds18b20_info);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "pool exhausted");
+    }
+    return ds18b20_info;
+}
+
+void ds18b20_pool_release(DS18B20_Info ** ds18b20_info)
+{
+    if (ds18b20_info != NULL && (*ds18b20_info != NULL))
+    {
+        ptrdiff_t i = *ds18b20_info - _pool;
+        if (i >= 0 && i < DS18B20_POOL_SIZE)
+        {
+            ESP_LOGD(TAG, "pool release %p", *ds18b20_info);
+            (*ds18b20_info)->init = false;
+            portENTER_CRITICAL(&_pool_lock);
+            _pool_used[i] = false;
+            portEXIT_CRITICAL(&_pool_lock);
+            *ds18b20_info = NULL;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "%p is not from the pool", *ds18b20_info);
+        }
+    }
+}
+
+size_t ds18b20_pool_in_use(void)
+{
+    size_t count = 0;
+    portENTER_CRITICAL(&_pool_lock);
+    for (size_t i = 0; i < DS18B20_POOL_SIZE; ++i)
+    {
+        count += _pool_used[i];
+    }
+    portEXIT_CRITICAL(&_pool_lock);
+    return count;
+}
+
 void ds18b20_init(DS18B20_Info * ds18b20_info, const OneWireBus * bus, OneWireBus_ROMCode rom_code)
 {
     if (ds18b20_info != NULL)
@@ -407,35 +517,81 @@ bool ds18b20_set_resolution(DS18B20_Info * ds18b20_info, DS18B20_RESOLUTION reso
     bool result = false;
     if (_is_init(ds18b20_info))
     {
-        if (_check_resolution(ds18b20_info->resolution))
+        if (!ds18b20_info->config_cached)
+        {
+            ds18b20_info->resolution = ds18b20_read_resolution(ds18b20_info);
+        }
+
+        // keep the alarm triggers currently held by the device
+        DS18B20_Config config = {
+            .resolution = resolution,
+            .trigger_high = ds18b20_info->trigger_high,
+            .trigger_low = ds18b20_info->trigger_low,
+        };
+        result = ds18b20_configure(ds18b20_info, &config, /* persist */ false);
+        if (result)
+        {
+            ESP_LOGD(TAG, "Resolution set to %d bits", (int)resolution);
+        }
+    }
+    return result;
+}
+
+bool ds18b20_configure(DS18B20_Info * ds18b20_info, const DS18B20_Config * config, bool persist)
+{
+    bool result = false;
+    if (_is_init(ds18b20_info))
+    {
+        if (config != NULL && _check_resolution(config->resolution))
         {
-            // read scratchpad up to and including configuration register
-            Scratchpad scratchpad = {0};
-            _read_scratchpad(ds18b20_info, &scratchpad,
-                    offsetof(Scratchpad, configuration) - offsetof(Scratchpad, temperature) + 1);
-
-            // modify configuration register to set resolution
-            uint8_t value = (((resolution - 1) & 0x03) << 5) | 0x1f;
-            scratchpad.configuration = value;
-            ESP_LOGD(TAG, "configuration value 0x%02x", value);
-
-            // write bytes 2, 3 and 4 of scratchpad
-            result = _write_scratchpad(ds18b20_info, &scratchpad, /* verify */ true);
-            if (result)
+            if (!ds18b20_info->config_cached)
+            {
+                ds18b20_info->resolution = ds18b20_read_resolution(ds18b20_info);
+            }
+
+            if (ds18b20_info->config_cached && _config_matches(ds18b20_info, config))
             {
-                ds18b20_info->resolution = resolution;
-                ESP_LOGD(TAG, "Resolution set to %d bits", (int)resolution);
+                ESP_LOGD(TAG, "Configuration unchanged, scratchpad write skipped");
+                result = true;
             }
             else
             {
-                // Resolution change failed - update the info resolution with the value read from configuration
-                ds18b20_info->resolution = ds18b20_read_resolution(ds18b20_info);
-                ESP_LOGW(TAG, "Resolution consistency lost - refreshed from device: %d", ds18b20_info->resolution);
+                Scratchpad scratchpad = {0};
+                scratchpad.trigger_high = (uint8_t)config->trigger_high;
+                scratchpad.trigger_low = (uint8_t)config->trigger_low;
+                scratchpad.configuration = _encode_configuration(config->resolution);
+                ESP_LOGD(TAG, "configuration value 0x%02x", scratchpad.configuration);
+
+                // write bytes 2, 3 and 4 of scratchpad
+                result = _write_scratchpad(ds18b20_info, &scratchpad, /* verify */ true);
+                if (result)
+                {
+                    ds18b20_info->resolution = config->resolution;
+                    ds18b20_info->trigger_high = config->trigger_high;
+                    ds18b20_info->trigger_low = config->trigger_low;
+                    ds18b20_info->config_cached = true;
+                    ds18b20_info->config_dirty = true;
+                }
+                else
+                {
+                    // Configuration change failed - update the cache with the values read from the device
+                    ds18b20_info->resolution = ds18b20_read_resolution(ds18b20_info);
+                    ESP_LOGW(TAG, "Resolution consistency lost - refreshed from device: %d", ds18b20_info->resolution);
+                }
+            }
+
+            if (result && persist && ds18b20_info->config_dirty)
+            {
+                result = _copy_scratchpad(ds18b20_info);
+                if (result)
+                {
+                    ds18b20_info->config_dirty = false;
+                }
             }
         }
         else
         {
-            ESP_LOGE(TAG, "Unsupported resolution %d", resolution);
+            ESP_LOGE(TAG, "Unsupported resolution %d", config ? (int)config->resolution : (int)DS18B20_RESOLUTION_INVALID);
         }
     }
     return result;
@@ -448,10 +604,10 @@ DS18B20_RESOLUTION ds18b20_read_resolution(DS18B20_Info * ds18b20_info)
     {
         // read scratchpad up to and including configuration register
         Scratchpad scratchpad = {0};
-        _read_scratchpad(ds18b20_info, &scratchpad,
+        DS18B20_ERROR err = _read_scratchpad(ds18b20_info, &scratchpad,
                 offsetof(Scratchpad, configuration) - offsetof(Scratchpad, temperature) + 1);
 
-        resolution = ((scratchpad.configuration >> 5) & 0x03) + DS18B20_RESOLUTION_9_BIT;
+        resolution = _decode_configuration(scratchpad.configuration);
         if (!_check_resolution(resolution))
         {
             ESP_LOGE(TAG, "invalid resolution read from device: 0x%02x", scratchpad.configuration);
@@ -461,6 +617,17 @@ DS18B20_RESOLUTION ds18b20_read_resolution(DS18B20_Info * ds18b20_info)
         {
             ESP_LOGD(TAG, "Resolution read as %d", resolution);
         }
+
+        // keep the triggers for the next configuration write, CRC or not
+        if (err == DS18B20_OK)
+        {
+            ds18b20_info->trigger_high = (int8_t)scratchpad.trigger_high;
+            ds18b20_info->trigger_low = (int8_t)scratchpad.trigger_low;
+        }
+
+        // only skip writes on the cache if the whole scratchpad passed its CRC check
+        ds18b20_info->config_cached = (err == DS18B20_OK) && ds18b20_info->use_crc
+                                      && resolution != DS18B20_RESOLUTION_INVALID;
     }
     return resolution;
 }
@@ -521,6 +688,38 @@ float ds18b20_wait_for_conversion(const DS18B20_Info * ds18b20_info)
     return elapsed_time;
 }
 
+static DS18B20_ERROR _read_temp_bytes(const DS18B20_Info * ds18b20_info, uint8_t * lsb, uint8_t * msb)
+{
+    uint8_t temp_LSB = 0x00;
+    uint8_t temp_MSB = 0x80;
+    Scratchpad scratchpad = {0};
+    DS18B20_ERROR err = DS18B20_ERROR_UNKNOWN;
+    if ((err = _read_scratchpad(ds18b20_info, &scratchpad, 2)) == DS18B20_OK)
+    {
+        temp_LSB = scratchpad.temperature[0];
+        temp_MSB = scratchpad.temperature[1];
+    }
+
+    // https://github.com/cpetrich/counterfeit_DS18B20#solution-to-the-85-c-problem
+    if (scratchpad.reserved[1] == 0x0c && temp_MSB == 0x05 && temp_LSB == 0x50)
+    {
+        ESP_LOGE(TAG, "Read power-on value (85.0)");
+        err = DS18B20_ERROR_DEVICE;
+    }
+
+    // Without a known resolution the bytes cannot be decoded, and would
+    // otherwise pass for a good reading of 0 C
+    if (err == DS18B20_OK && !_check_resolution(ds18b20_info->resolution))
+    {
+        ESP_LOGE(TAG, "Resolution unknown, cannot decode temperature");
+        err = DS18B20_ERROR_DEVICE;
+    }
+
+    *lsb = temp_LSB;
+    *msb = temp_MSB;
+    return err;
+}
+
 DS18B20_ERROR ds18b20_read_temp(const DS18B20_Info * ds18b20_info, float * value)
 {
     DS18B20_ERROR err = DS18B20_ERROR_UNKNOWN;
@@ -528,19 +727,7 @@ DS18B20_ERROR ds18b20_read_temp(const DS18B20_Info * ds18b20_info, float * value
     {
         uint8_t temp_LSB = 0x00;
         uint8_t temp_MSB = 0x80;
-        Scratchpad scratchpad = {0};
-        if ((err = _read_scratchpad(ds18b20_info, &scratchpad, 2)) == DS18B20_OK)
-        {
-            temp_LSB = scratchpad.temperature[0];
-            temp_MSB = scratchpad.temperature[1];
-        }
-
-        // https://github.com/cpetrich/counterfeit_DS18B20#solution-to-the-85-c-problem
-        if (scratchpad.reserved[1] == 0x0c && temp_MSB == 0x05 && temp_LSB == 0x50)
-        {
-            ESP_LOGE(TAG, "Read power-on value (85.0)");
-            err = DS18B20_ERROR_DEVICE;
-        }
+        err = _read_temp_bytes(ds18b20_info, &temp_LSB, &temp_MSB);
 
         float temp = _decode_temp(temp_LSB, temp_MSB, ds18b20_info->resolution);
         ESP_LOGD(TAG, "temp_LSB 0x%02x, temp_MSB 0x%02x, temp %f", temp_LSB, temp_MSB, temp);
@@ -553,6 +740,26 @@ DS18B20_ERROR ds18b20_read_temp(const DS18B20_Info * ds18b20_info, float * value
     return err;
 }
 
+DS18B20_ERROR ds18b20_read_temp_raw(const DS18B20_Info * ds18b20_info, int16_t * value)
+{
+    DS18B20_ERROR err = DS18B20_ERROR_UNKNOWN;
+    if (_is_init(ds18b20_info))
+    {
+        uint8_t temp_LSB = 0x00;
+        uint8_t temp_MSB = 0x80;
+        err = _read_temp_bytes(ds18b20_info, &temp_LSB, &temp_MSB);
+
+        int16_t raw = _decode_raw(temp_LSB, temp_MSB, ds18b20_info->resolution);
+        ESP_LOGD(TAG, "temp_LSB 0x%02x, temp_MSB 0x%02x, raw %d", temp_LSB, temp_MSB, raw);
+
+        if (value)
+        {
+            *value = raw;
+        }
+    }
+    return err;
+}
+
 DS18B20_ERROR ds18b20_convert_and_read_temp(const DS18B20_Info * ds18b20_info, float * value)
 {
     DS18B20_ERROR err = DS18B20_ERROR_UNKNOWN;
@@ -577,6 +784,30 @@ DS18B20_ERROR ds18b20_convert_and_read_temp(const DS18B20_Info * ds18b20_info, f
     return err;
 }
 
+DS18B20_ERROR ds18b20_convert_and_read_temp_raw(const DS18B20_Info * ds18b20_info, int16_t * value)
+{
+    DS18B20_ERROR err = DS18B20_ERROR_UNKNOWN;
+    if (_is_init(ds18b20_info))
+    {
+        if (ds18b20_convert(ds18b20_info))
+        {
+            // wait at least maximum conversion time
+            ds18b20_wait_for_conversion(ds18b20_info);
+
+            if (value)
+            {
+                *value = 0;
+                err = ds18b20_read_temp_raw(ds18b20_info, value);
+            }
+            else
+            {
+                err = DS18B20_ERROR_NULL;
+            }
+        }
+    }
+    return err;
+}
+
 DS18B20_ERROR ds18b20_check_for_parasite_power(const OneWireBus * bus, bool * present)
 {
     DS18B20_ERROR err = DS18B20_ERROR_UNKNOWN;
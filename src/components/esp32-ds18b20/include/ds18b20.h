@@ -40,6 +40,10 @@
 extern "C" {
 #endif
 
+#ifndef DS18B20_POOL_SIZE
+#  define DS18B20_POOL_SIZE (4)  ///< Number of statically allocated device info instances
+#endif
+
 /**
  * @brief Success and error codes.
  */
@@ -65,6 +69,16 @@ typedef enum
     DS18B20_RESOLUTION_12_BIT  = 12,  ///< 12-bit resolution (default)
 } DS18B20_RESOLUTION;
 
+/**
+ * @brief Device configuration held in scratchpad bytes 2, 3 and 4 (and mirrored in EEPROM).
+ */
+typedef struct
+{
+    DS18B20_RESOLUTION resolution; ///< Temperature measurement resolution per reading
+    int8_t trigger_high;           ///< TH alarm trigger, in degrees Celsius
+    int8_t trigger_low;            ///< TL alarm trigger, in degrees Celsius
+} DS18B20_Config;
+
 /**
  * @brief Structure containing information related to a single DS18B20 device connected
  * via a 1-Wire bus.
@@ -77,6 +91,10 @@ typedef struct
     const OneWireBus * bus;        ///< Pointer to 1-Wire bus information relevant to this device
     OneWireBus_ROMCode rom_code;   ///< The ROM code used to address this device on the bus
     DS18B20_RESOLUTION resolution; ///< Temperature measurement resolution per reading
+    bool config_cached;            ///< True if the cached configuration passed a CRC check, so unchanged writes can be skipped
+    bool config_dirty;             ///< True if the scratchpad has been written but not copied to EEPROM
+    int8_t trigger_high;           ///< TH alarm trigger last read from or written to the device, in degrees Celsius
+    int8_t trigger_low;            ///< TL alarm trigger last read from or written to the device, in degrees Celsius
 } DS18B20_Info;
 
 /**
@@ -93,6 +111,27 @@ DS18B20_Info * ds18b20_malloc(void);
  */
 void ds18b20_free(DS18B20_Info ** ds18b20_info);
 
+/**
+ * @brief Take a device info instance from the static pool.
+ *
+ * Unlike ds18b20_malloc() this never touches the heap. The pool holds
+ * DS18B20_POOL_SIZE instances. New instance should be initialised before calling other functions.
+ * @return Pointer to a zeroed device info instance, or NULL if the pool is exhausted.
+ */
+DS18B20_Info * ds18b20_pool_alloc(void);
+
+/**
+ * @brief Return a device info instance to the static pool.
+ * @param[in,out] ds18b20_info Pointer to device info instance that will be released and set to NULL.
+ */
+void ds18b20_pool_release(DS18B20_Info ** ds18b20_info);
+
+/**
+ * @brief Number of pool instances currently allocated.
+ * @return Count of allocated instances, at most DS18B20_POOL_SIZE.
+ */
+size_t ds18b20_pool_in_use(void);
+
 /**
  * @brief Initialise a device info instance with the specified GPIO.
  * @param[in] ds18b20_info Pointer to device info instance.
@@ -126,6 +165,7 @@ void ds18b20_use_crc(DS18B20_Info * ds18b20_info, bool use_crc);
  *
  * This programs the hardware to the specified resolution and sets the cached value to be the same.
  * If the program fails, the value currently in hardware is used to refresh the cache.
+ * The hardware is not written if the cached configuration already has this resolution.
  *
  * @param[in] ds18b20_info Pointer to device info instance.
  * @param[in] resolution Selected resolution.
@@ -133,6 +173,21 @@ void ds18b20_use_crc(DS18B20_Info * ds18b20_info, bool use_crc);
  */
 bool ds18b20_set_resolution(DS18B20_Info * ds18b20_info, DS18B20_RESOLUTION resolution);
 
+/**
+ * @brief Bring the device configuration (resolution, TH and TL) in line with the requested values.
+ *
+ * The configuration read from the device at initialisation is cached, and the scratchpad is
+ * only written (and verified) if the requested configuration differs from the cache.
+ * The scratchpad is only copied to EEPROM if persistence is requested and the EEPROM
+ * contents may differ from the scratchpad.
+ *
+ * @param[in] ds18b20_info Pointer to device info instance.
+ * @param[in] config Requested device configuration.
+ * @param[in] persist True to also copy the configuration to the device EEPROM.
+ * @return True if the device holds the requested configuration, otherwise false.
+ */
+bool ds18b20_configure(DS18B20_Info * ds18b20_info, const DS18B20_Config * config, bool persist);
+
 /**
  * @brief Update and return the current temperature measurement resolution from the device.
  * @param[in] ds18b20_info Pointer to device info instance.
@@ -182,6 +237,24 @@ float ds18b20_wait_for_conversion(const DS18B20_Info * ds18b20_info);
  */
 DS18B20_ERROR ds18b20_read_temp(const DS18B20_Info * ds18b20_info, float * value);
 
+/**
+ * @brief Read last temperature measurement from device without converting it to floating point.
+ * @param[in] ds18b20_info Pointer to device info instance. Must be initialised first.
+ * @param[out] value Pointer to the raw measurement value returned by the device, in 1/16 degrees Celsius.
+ *                   Bits that are undefined at the current resolution are cleared.
+ * @return DS18B20_OK if read is successful, DS18B20_ERROR_DEVICE if the resolution is
+ *         not known, otherwise error.
+ */
+DS18B20_ERROR ds18b20_read_temp_raw(const DS18B20_Info * ds18b20_info, int16_t * value);
+
+/**
+ * @brief Convert, wait and read current temperature from device.
+ * @param[in] ds18b20_info Pointer to device info instance. Must be initialised first.
+ * @param[out] value Pointer to the raw measurement value returned by the device, in 1/16 degrees Celsius.
+ * @return DS18B20_OK if read is successful, otherwise error.
+ */
+DS18B20_ERROR ds18b20_convert_and_read_temp_raw(const DS18B20_Info * ds18b20_info, int16_t * value);
+
 /**
  * @brief Convert, wait and read current temperature from device.
  * @param[in] ds18b20_info Pointer to device info instance. Must be initialised first.
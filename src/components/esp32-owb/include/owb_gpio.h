@@ -43,6 +43,10 @@
 extern "C" {
 #endif
 
+#ifndef OWB_GPIO_POOL_SIZE
+#  define OWB_GPIO_POOL_SIZE (1)  ///< Number of statically allocated GPIO driver info instances
+#endif
+
 /**
  * @brief GPIO driver information
  */
@@ -63,6 +67,18 @@ OneWireBus * owb_gpio_initialize(owb_gpio_driver_info *driver_info, int gpio);
  */
 void owb_gpio_uninitialize(owb_gpio_driver_info *driver_info);
 
+/**
+ * @brief Take a GPIO driver info instance from the static pool.
+ * @return Pointer to a zeroed driver info instance, or NULL if the pool is exhausted.
+ */
+owb_gpio_driver_info * owb_gpio_pool_alloc(void);
+
+/**
+ * @brief Return a GPIO driver info instance to the static pool.
+ * @param[in,out] driver_info Pointer to driver info instance that will be released and set to NULL.
+ */
+void owb_gpio_pool_release(owb_gpio_driver_info ** driver_info);
+
 #ifdef __cplusplus
 }
 #endif
@@ -44,6 +44,10 @@
 extern "C" {
 #endif
 
+#ifndef OWB_RMT_POOL_SIZE
+#  define OWB_RMT_POOL_SIZE (1)  ///< Number of statically allocated RMT driver info instances
+#endif
+
 /**
  * @brief RMT driver information
  */
@@ -68,6 +72,20 @@ typedef struct
 OneWireBus* owb_rmt_initialize(owb_rmt_driver_info * info, gpio_num_t gpio_num,
                                rmt_channel_t tx_channel, rmt_channel_t rx_channel);
 
+/**
+ * @brief Take an RMT driver info instance from the static pool.
+ *        The instance remains valid until released, as required by owb_rmt_initialize().
+ * @return Pointer to a zeroed driver info instance, or NULL if the pool is exhausted.
+ */
+owb_rmt_driver_info * owb_rmt_pool_alloc(void);
+
+/**
+ * @brief Return an RMT driver info instance to the static pool.
+ *        The bus should be uninitialised first.
+ * @param[in,out] info Pointer to driver info instance that will be released and set to NULL.
+ */
+void owb_rmt_pool_release(owb_rmt_driver_info ** info);
+
 #ifdef __cplusplus
 }
 #endif
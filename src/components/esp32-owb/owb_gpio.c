@@ -46,6 +46,10 @@
 
 static const char * TAG = "owb_gpio";
 
+static owb_gpio_driver_info _pool[OWB_GPIO_POOL_SIZE];
+static bool _pool_used[OWB_GPIO_POOL_SIZE];
+static portMUX_TYPE _pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
 // Define PHY_DEBUG to enable GPIO output around when the bus is sampled
 // by the master (this library). This GPIO output makes it possible to
 // validate the master's sampling using an oscilloscope.
@@ -287,3 +291,50 @@ OneWireBus* owb_gpio_initialize(owb_gpio_driver_info * driver_info, int gpio)
 
     return &(driver_info->bus);
 }
+
+owb_gpio_driver_info * owb_gpio_pool_alloc(void)
+{
+    owb_gpio_driver_info * info = NULL;
+    portENTER_CRITICAL(&_pool_lock);
+    for (size_t i = 0; i < OWB_GPIO_POOL_SIZE; ++i)
+    {
+        if (!_pool_used[i])
+        {
+            _pool_used[i] = true;
+            info = &_pool[i];
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&_pool_lock);
+
+    if (info != NULL)
+    {
+        memset(info, 0, sizeof(*info));
+        ESP_LOGD(TAG, "pool alloc %p", info);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "pool exhausted");
+    }
+    return info;
+}
+
+void owb_gpio_pool_release(owb_gpio_driver_info ** info)
+{
+    if (info != NULL && (*info != NULL))
+    {
+        ptrdiff_t i = *info - _pool;
+        if (i >= 0 && i < OWB_GPIO_POOL_SIZE)
+        {
+            ESP_LOGD(TAG, "pool release %p", *info);
+            portENTER_CRITICAL(&_pool_lock);
+            _pool_used[i] = false;
+            portEXIT_CRITICAL(&_pool_lock);
+            *info = NULL;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "%p is not from the pool", *info);
+        }
+    }
+}
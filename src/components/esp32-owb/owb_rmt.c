@@ -56,6 +56,8 @@ sample code bearing this copyright.
 //--------------------------------------------------------------------------
 */
 
+#include <string.h>
+
 #include "owb.h"
 
 #include "driver/rmt.h"
@@ -94,6 +96,10 @@ static const char * TAG = "owb_rmt";
 
 #define info_of_driver(owb) container_of(owb, owb_rmt_driver_info, bus)
 
+static owb_rmt_driver_info _pool[OWB_RMT_POOL_SIZE];
+static bool _pool_used[OWB_RMT_POOL_SIZE];
+static portMUX_TYPE _pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
 // flush any pending/spurious traces from the RX channel
 static void onewire_flush_rmt_rx_buf(const OneWireBus * bus)
 {
@@ -473,3 +479,50 @@ OneWireBus * owb_rmt_initialize(owb_rmt_driver_info * info, gpio_num_t gpio_num,
 
     return &(info->bus);
 }
+
+owb_rmt_driver_info * owb_rmt_pool_alloc(void)
+{
+    owb_rmt_driver_info * info = NULL;
+    portENTER_CRITICAL(&_pool_lock);
+    for (size_t i = 0; i < OWB_RMT_POOL_SIZE; ++i)
+    {
+        if (!_pool_used[i])
+        {
+            _pool_used[i] = true;
+            info = &_pool[i];
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&_pool_lock);
+
+    if (info != NULL)
+    {
+        memset(info, 0, sizeof(*info));
+        ESP_LOGD(TAG, "pool alloc %p", info);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "pool exhausted");
+    }
+    return info;
+}
+
+void owb_rmt_pool_release(owb_rmt_driver_info ** info)
+{
+    if (info != NULL && (*info != NULL))
+    {
+        ptrdiff_t i = *info - _pool;
+        if (i >= 0 && i < OWB_RMT_POOL_SIZE)
+        {
+            ESP_LOGD(TAG, "pool release %p", *info);
+            portENTER_CRITICAL(&_pool_lock);
+            _pool_used[i] = false;
+            portEXIT_CRITICAL(&_pool_lock);
+            *info = NULL;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "%p is not from the pool", *info);
+        }
+    }
+}
@@ -0,0 +1,89 @@
+#include "boot.h"
+
+#include <stdatomic.h>
+
+#include "clock.h"
+#include "constants.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "eventlog.h"
+
+static const char* TAG = "boot";
+
+// Zero means not reached: nothing is marked at exactly boot
+static atomic_llong phase_us[BOOT_PHASE_COUNT];
+
+static esp_timer_handle_t budget_timer;
+static atomic_bool budget_checked;
+static atomic_bool over_budget;
+
+static const char* phase_names[BOOT_PHASE_COUNT] = {
+    [BOOT_STATE_RESTORED] = "state restored",
+    [BOOT_CONTROL_STARTED] = "control started",
+    [BOOT_FIRST_SAMPLE] = "first sample",
+    [BOOT_FIRST_DECISION] = "first decision",
+    [BOOT_WIFI_CONNECTED] = "wifi connected",
+    [BOOT_TIME_SYNCED] = "time synced",
+    [BOOT_NETWORK_READY] = "network ready",
+};
+
+// Once, at the first decision or at the deadline, whichever comes first.
+// decision_us is -1 if there has been none.
+static void check_budget(int64_t decision_us) {
+  if (atomic_exchange(&budget_checked, true)) {
+    return;
+  }
+  if (decision_us >= 0 && decision_us <= BOOT_FIRST_DECISION_BUDGET_US) {
+    return;
+  }
+  atomic_store(&over_budget, true);
+  if (decision_us < 0) {
+    ESP_LOGE(TAG, "No control decision within the %lld ms budget",
+             BOOT_FIRST_DECISION_BUDGET_US / 1000);
+    eventlog_append(EVENT_SLOW_BOOT, -1);
+  } else {
+    ESP_LOGE(TAG, "First control decision took %lld ms, budget is %lld ms",
+             decision_us / 1000, BOOT_FIRST_DECISION_BUDGET_US / 1000);
+    int64_t tenths = decision_us / 100000;
+    eventlog_append(EVENT_SLOW_BOOT, tenths < INT16_MAX ? tenths : INT16_MAX);
+  }
+}
+
+void boot_mark(BootPhase phase) {
+  long long expected = 0;
+  long long now_us = clock_now_us();
+  if (!atomic_compare_exchange_strong(&phase_us[phase], &expected, now_us)) {
+    return;  // Already marked
+  }
+  ESP_LOGI(TAG, "%s at %lld ms", phase_names[phase], now_us / 1000);
+  if (phase == BOOT_FIRST_DECISION) {
+    check_budget(now_us);
+  }
+}
+
+static void budget_deadline(void* arg) {
+  check_budget(boot_phase_us(BOOT_FIRST_DECISION));
+}
+
+void boot_start_budget_check() {
+  esp_timer_create_args_t args = {
+      .callback = budget_deadline,
+      .name = "boot budget",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&args, &budget_timer));
+  int64_t now_us = clock_now_us();
+  ESP_ERROR_CHECK(esp_timer_start_once(
+      budget_timer, now_us < BOOT_FIRST_DECISION_BUDGET_US
+                        ? BOOT_FIRST_DECISION_BUDGET_US - now_us + 1
+                        : 1));
+}
+
+bool boot_over_budget() { return atomic_load(&over_budget); }
+
+int64_t boot_phase_us(BootPhase phase) {
+  long long us = atomic_load(&phase_us[phase]);
+  return us ? us : -1;
+}
+
+const char* boot_phase_name(BootPhase phase) { return phase_names[phase]; }
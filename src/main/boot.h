@@ -0,0 +1,43 @@
+/*
+ * Records when each stage of the boot sequence finished, so the time to the
+ * first control decision can be measured and kept in check.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _BOOT_H_
+#define _BOOT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+  BOOT_STATE_RESTORED = 0,  // State initialized and restored from NVS/RTC
+  BOOT_CONTROL_STARTED,     // Sampler, relay and heartbeat tasks created
+  BOOT_FIRST_SAMPLE,        // First fused temperature
+  BOOT_FIRST_DECISION,      // First relay decision on a live temperature
+  BOOT_WIFI_CONNECTED,
+  BOOT_TIME_SYNCED,
+  BOOT_NETWORK_READY,  // mDNS and the HTTP server started
+  BOOT_PHASE_COUNT,
+} BootPhase;
+
+// Records the first time a phase is reached. Safe from any task.
+void boot_mark(BootPhase);
+
+// Checks BOOT_FIRST_DECISION against BOOT_FIRST_DECISION_BUDGET_US when it
+// is marked, or at the deadline if it has not been by then. A miss goes in
+// the event log, where a bench harness can fail a run on it, and is flagged
+// on the webpage. Call once, early in app_main().
+void boot_start_budget_check();
+// True once the budget has been missed
+bool boot_over_budget();
+
+// Microseconds since boot at which the phase was reached, or -1 if not yet
+int64_t boot_phase_us(BootPhase);
+const char* boot_phase_name(BootPhase);
+
+#endif  // _BOOT_H_
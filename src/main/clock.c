@@ -0,0 +1,67 @@
+#include "clock.h"
+
+#include "constants.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+static const char* TAG = "clock";
+
+static ClockStats stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int64_t wall_now_us() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+int64_t clock_now_us() { return esp_timer_get_time(); }
+
+bool clock_wall_valid() {
+  // The system time is kept across a soft reset, so it can be right before
+  // SNTP has said anything
+  return stats.syncs > 0 || time(NULL) >= CLOCK_MIN_VALID_WALL_S;
+}
+
+time_t clock_to_wall_s(int64_t mono_us) {
+  int64_t offset_us = wall_now_us() - clock_now_us();
+  return (mono_us + offset_us) / 1000000LL;
+}
+
+int64_t clock_from_wall_s(time_t wall_s) {
+  int64_t offset_us = wall_now_us() - clock_now_us();
+  return (int64_t)wall_s * 1000000LL - offset_us;
+}
+
+// Called from the SNTP task with the time from the server. In smooth sync
+// mode the system time is slewed towards it rather than stepped, so the
+// error shrinks over the following minutes instead of at once.
+void clock_on_sync(struct timeval* tv) {
+  int64_t now_us = clock_now_us();
+  int64_t server_us = (int64_t)tv->tv_sec * 1000000LL + tv->tv_usec;
+  int64_t offset_us = server_us - now_us;
+
+  // A local clock that runs fast falls behind the server's in offset
+  portENTER_CRITICAL(&stats_lock);
+  if (stats.syncs > 0 && now_us > stats.last_sync_us) {
+    stats.drift_ppm = (float)(stats.offset_us - offset_us) * 1e6f /
+                      (float)(now_us - stats.last_sync_us);
+  }
+  stats.error_us = server_us - wall_now_us();
+  stats.offset_us = offset_us;
+  stats.last_sync_us = now_us;
+  stats.syncs++;
+  ClockStats copy = stats;
+  portEXIT_CRITICAL(&stats_lock);
+
+  ESP_LOGI(TAG, "SNTP sync %lu: error %lld us, drift %0.1f ppm", copy.syncs,
+           copy.error_us, copy.drift_ppm);
+}
+
+ClockStats clock_get_stats() {
+  portENTER_CRITICAL(&stats_lock);
+  ClockStats copy = stats;
+  portEXIT_CRITICAL(&stats_lock);
+  return copy;
+}
@@ -0,0 +1,48 @@
+/*
+ * Monotonic time for scheduling and wall-clock time for display. Scheduling
+ * runs on esp_timer_get_time(), which never jumps, so an SNTP step cannot
+ * move a deadline. The wall clock is only used to show times to people and
+ * to carry them across a reboot.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
+
+// A monotonic time for something that has not happened since boot
+#define CLOCK_NEVER_US INT64_MIN
+
+// What SNTP has told us about the local clock
+typedef struct {
+  uint32_t syncs;
+  int64_t last_sync_us;  // Monotonic
+  int64_t offset_us;     // Wall minus monotonic time at the last sync
+  int64_t error_us;      // How far the wall clock was off at the last sync
+  float drift_ppm;       // Local clock rate error, positive when fast
+} ClockStats;
+
+// Microseconds since boot
+int64_t clock_now_us();
+
+// False until SNTP has set the time, or the time survived a soft reset
+bool clock_wall_valid();
+
+// Conversions at the current offset. Only meaningful if clock_wall_valid().
+time_t clock_to_wall_s(int64_t mono_us);
+int64_t clock_from_wall_s(time_t wall_s);
+
+// SNTP sync notification, for esp_sntp_config_t.sync_cb
+void clock_on_sync(struct timeval* tv);
+
+ClockStats clock_get_stats();
+
+#endif  // _CLOCK_H_
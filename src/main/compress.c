@@ -0,0 +1,184 @@
+#include "compress.h"
+
+#include <string.h>
+
+// Bit codes, most significant bit first. Each is a prefix giving a class,
+// then the value in that class's width, offset to be non-negative.
+//
+// Change in the interval, s
+//   0                   0
+//   10   + 7 bits       -63 to 64
+//   110  + 9 bits       -255 to 256
+//   1110 + 12 bits      -2047 to 2048
+//   1111 + 32 bits      anything else
+//
+// Change in the temperature, zig-zag coded (0, -1, 1, -2, ... -> 0, 1, 2,
+// 3, ...) so small changes either way get small codes
+//   0                   0
+//   10   + 4 bits       up to 15
+//   110  + 8 bits       up to 255
+//   111  + 17 bits      anything else
+//
+// The first sample is its time (32 bits) and temperature (16 bits) in full.
+
+typedef struct {
+  uint8_t prefix_bits;
+  uint8_t value_bits;
+  uint32_t prefix;
+  int64_t min;  // Smallest value in the class
+  int64_t max;
+} Code;
+
+static const Code interval_codes[] = {
+    {1, 0, 0x0, 0, 0},
+    {2, 7, 0x2, -63, 64},
+    {3, 9, 0x6, -255, 256},
+    {4, 12, 0xe, -2047, 2048},
+    {4, 32, 0xf, INT32_MIN, INT32_MAX},
+};
+
+static const Code delta_codes[] = {
+    {1, 0, 0x0, 0, 0},
+    {2, 4, 0x2, 0, 15},
+    {3, 8, 0x6, 0, 255},
+    {3, 17, 0x7, 0, 131071},
+};
+
+#define CODE_COUNT(codes) (sizeof(codes) / sizeof(codes[0]))
+
+static uint32_t zigzag(int32_t n) { return ((uint32_t)n << 1) ^ (n >> 31); }
+static int32_t unzigzag(uint32_t n) { return (n >> 1) ^ -(int32_t)(n & 1); }
+
+// Picks the shortest code for a value, NULL if none holds it
+static const Code* code_for(const Code* codes, size_t count, int64_t value) {
+  for (size_t i = 0; i < count; i++) {
+    if (value >= codes[i].min && value <= codes[i].max) {
+      return &codes[i];
+    }
+  }
+  return NULL;
+}
+
+static void put_bits(TempEncoder* e, uint32_t value, uint8_t n) {
+  for (int i = n - 1; i >= 0; i--) {
+    if ((value >> i) & 1) {
+      e->buf[e->bits / 8] |= 0x80 >> (e->bits % 8);
+    }
+    e->bits++;
+  }
+}
+
+static void put_code(TempEncoder* e, const Code* code, int64_t value) {
+  put_bits(e, code->prefix, code->prefix_bits);
+  put_bits(e, (uint32_t)(value - code->min), code->value_bits);
+}
+
+void temp_encoder_init(TempEncoder* e, uint8_t* buf, size_t size) {
+  *e = (TempEncoder){.buf = buf, .size = size};
+  memset(buf, 0, size);
+}
+
+bool temp_encode(TempEncoder* e, uint32_t time_s, int16_t raw) {
+  if (e->count == 0) {
+    if (e->size * 8 < 48) {
+      return false;
+    }
+    put_bits(e, time_s, 32);
+    put_bits(e, (uint16_t)raw, 16);
+  } else {
+    int64_t interval_s = (int64_t)time_s - e->time_s;
+    const Code* interval_code =
+        code_for(interval_codes, CODE_COUNT(interval_codes),
+                 interval_s - e->interval_s);
+    uint32_t delta = zigzag(raw - e->raw);
+    const Code* delta_code =
+        code_for(delta_codes, CODE_COUNT(delta_codes), delta);
+    if (interval_code == NULL || delta_code == NULL ||
+        e->count == UINT16_MAX) {
+      return false;
+    }
+    size_t bits = interval_code->prefix_bits + interval_code->value_bits +
+                  delta_code->prefix_bits + delta_code->value_bits;
+    if (e->bits + bits > e->size * 8) {
+      return false;
+    }
+    put_code(e, interval_code, interval_s - e->interval_s);
+    put_code(e, delta_code, delta);
+    e->interval_s = interval_s;
+  }
+  e->time_s = time_s;
+  e->raw = raw;
+  e->count++;
+  return true;
+}
+
+void temp_decoder_init(TempDecoder* d, const uint8_t* buf, size_t size,
+                       uint16_t count) {
+  *d = (TempDecoder){.buf = buf, .bits = size * 8, .remaining = count};
+}
+
+static bool get_bits(TempDecoder* d, uint8_t n, uint32_t* value) {
+  if (d->pos + n > d->bits) {
+    return false;
+  }
+  *value = 0;
+  for (int i = 0; i < n; i++) {
+    *value = (*value << 1) | ((d->buf[d->pos / 8] >> (7 - d->pos % 8)) & 1);
+    d->pos++;
+  }
+  return true;
+}
+
+// Reads the prefix bit by bit until it matches a class
+static bool get_code(TempDecoder* d, const Code* codes, size_t count,
+                     int64_t* value) {
+  uint32_t prefix = 0;
+  uint8_t prefix_bits = 0;
+  for (size_t i = 0; i < count; i++) {
+    while (prefix_bits < codes[i].prefix_bits) {
+      uint32_t bit;
+      if (!get_bits(d, 1, &bit)) {
+        return false;
+      }
+      prefix = (prefix << 1) | bit;
+      prefix_bits++;
+    }
+    if (prefix == codes[i].prefix) {
+      uint32_t v;
+      if (!get_bits(d, codes[i].value_bits, &v)) {
+        return false;
+      }
+      *value = codes[i].min + v;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool temp_decode(TempDecoder* d, uint32_t* time_s, int16_t* raw) {
+  if (d->remaining == 0) {
+    return false;
+  }
+  if (d->decoded == 0) {
+    uint32_t t, r;
+    if (!get_bits(d, 32, &t) || !get_bits(d, 16, &r)) {
+      return false;
+    }
+    d->time_s = t;
+    d->raw = (int16_t)r;
+  } else {
+    int64_t change, delta;
+    if (!get_code(d, interval_codes, CODE_COUNT(interval_codes), &change) ||
+        !get_code(d, delta_codes, CODE_COUNT(delta_codes), &delta)) {
+      return false;
+    }
+    d->interval_s += change;
+    d->time_s += d->interval_s;
+    d->raw += unzigzag(delta);
+  }
+  d->remaining--;
+  d->decoded++;
+  *time_s = d->time_s;
+  *raw = d->raw;
+  return true;
+}
@@ -0,0 +1,62 @@
+/*
+ * Compression for the temperature time series, after Facebook's Gorilla:
+ * timestamps as the change in the sampling interval (delta of delta) and
+ * temperatures as zig-zag deltas of the raw 1/16 C value, both in short
+ * variable length bit codes. A steady one minute series with small changes
+ * takes a few bits a sample. Pure C, no FreeRTOS, so it can also be built
+ * on a host.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Appends samples one at a time to a caller's buffer (a block). The block
+// does not record how many samples it holds: keep count alongside it.
+typedef struct {
+  uint8_t* buf;
+  size_t size;
+  size_t bits;  // Written so far
+  uint16_t count;
+  uint32_t time_s;
+  int64_t interval_s;
+  int16_t raw;
+} TempEncoder;
+
+void temp_encoder_init(TempEncoder*, uint8_t* buf, size_t size);
+
+// False, with the block unchanged, if the sample does not fit: time to
+// start a new block
+bool temp_encode(TempEncoder*, uint32_t time_s, int16_t raw);
+
+static inline size_t temp_encoder_bytes(const TempEncoder* e) {
+  return (e->bits + 7) / 8;
+}
+
+// Reads back a block of count samples
+typedef struct {
+  const uint8_t* buf;
+  size_t bits;  // In the block
+  size_t pos;
+  uint16_t remaining;
+  uint16_t decoded;
+  uint32_t time_s;
+  int64_t interval_s;
+  int16_t raw;
+} TempDecoder;
+
+void temp_decoder_init(TempDecoder*, const uint8_t* buf, size_t size,
+                       uint16_t count);
+
+// False at the end of the block, or if it is truncated
+bool temp_decode(TempDecoder*, uint32_t* time_s, int16_t* raw);
+
+#endif  // _COMPRESS_H_
@@ -5,18 +5,113 @@
 #define _CONSTANTS_H_
 
 #define DEFAULT_FREEZE_DANGER_TEMP_C 0
-#define RELAY_PERIOD_SCALING_CONSTANT 0.1
-#define CIRC_ON_TICKS 60 * configTICK_RATE_HZ  // 1 min
-#define MAX_CIRC_INTERVAL_S 60.0 * 60.0        // 60 min
+
+// Control policy defaults, see policy.h. All can be changed at /policy.
+// k in M = 60 / (1 + k * dT), per C, in thousandths
+#define RELAY_PERIOD_SCALING_MILLI 100
+#define CIRC_ON_S 60                   // 1 min
+#define MAX_CIRC_INTERVAL_S (60 * 60)  // 60 min
+// Stepped policy: how far below the threshold, and the interval there.
+// Each step sits between the formula's intervals at its two ends, e.g. 55
+// min from 0 to 2 C, where the formula goes from 60 to 50 min.
+#define POLICY_STEP_DEFICITS \
+  {0, TEMP16_FROM_C(2), TEMP16_FROM_C(5), TEMP16_FROM_C(10)}
+#define POLICY_STEP_INTERVALS_S {55 * 60, 45 * 60, 35 * 60, 25 * 60}
+// In test mode, shorter so a test does not take hours
+#define TEST_CIRC_ON_S 15
+#define TEST_MAX_CIRC_INTERVAL_S 60
 
 #define RELAY_PIN 33
-#define RELAY_TASK_INTERVAL_TICKS 1000 / portTICK_PERIOD_MS
+// A relay pulse further than this from its length is logged
+#define RELAY_PULSE_TOLERANCE_US 1000
+// CONFIG_RELAY_PULSE_CHECK, see partitions.csv
+#define RELAY_PULSE_CHECK_US (20 * 1000LL)
+#define RELAY_PULSE_CHECK_COUNT 8
+#define RELAY_PULSE_CHECK_PARTITION "scratch"
+#define RELAY_PULSE_CHECK_PARTITION_SUBTYPE 0x41
 
 #define TEMP_SENSOR_PIN 15
+#define TEMP_SENSOR_MAX_PROBES 3
+// The counterfeit ones make trouble with 9bit
+#define TEMP_SENSOR_RESOLUTION DS18B20_RESOLUTION_12_BIT
+// Alarms are not used; these are the usual factory values so nothing is
+// written to a new probe
+#define TEMP_SENSOR_ALARM_HIGH_C 75
+#define TEMP_SENSOR_ALARM_LOW_C 70
+
+#define STATE_MAX_SUBSCRIBERS 4
+
+// RAM event log, 4 bytes a record. A day of 1 min samples plus relay and
+// exposure events, in 16 kB; the flash log holds the rest. A power of two,
+// so the ring index stays continuous when the record count wraps.
+#define EVENTLOG_CAPACITY 4096
+
+// Flash log, see partitions.csv. Records go to flash a page at a time, or
+// after FLASHLOG_MAX_DELAY_US at the latest.
+#define FLASHLOG_PARTITION "log"
+#define FLASHLOG_PARTITION_SUBTYPE 0x40
+#define FLASHLOG_CHECK_TICKS 60 * configTICK_RATE_HZ  // 1 min
+#define FLASHLOG_MAX_DELAY_US (60 * 60 * 1000000LL)   // 1 h
+#define FLASHLOG_BATCH 64  // Events moved per check, at most
+// Other events held back while a compressed temperature block fills. The
+// block is closed early when one more comes with this many waiting.
+#define FLASHLOG_PENDING 16
+
+// Rollups, 16 bytes a row. 90 days of hours, 34 kB, and a year of days.
+#define SUMMARY_HOURS_CAPACITY (90 * 24)
+#define SUMMARY_DAYS_CAPACITY 366
+#define SUMMARY_REBUILD_CHECK_TICKS 10 * configTICK_RATE_HZ  // 10 s
+
+// Task and heap profiler
+#define PROFILE_PERIOD_TICKS 60 * configTICK_RATE_HZ  // 1 min
+#define PROFILE_HISTORY_LENGTH 32                     // About half an hour
+#define PROFILE_MAX_TASKS 24
+
+// Warn if the first relay decision on a live temperature comes later
+#define BOOT_FIRST_DECISION_BUDGET_US (10 * 1000000LL)  // 10 s
+
+// Configuration and relay history saved in NVS. Each class is written at
+// most once per interval; the first write after boot goes out at once.
+#define PERSIST_NAMESPACE "antifreeze"
+#define PERSIST_CONFIG_MIN_INTERVAL_US (60 * 1000000LL)      // 1 min
+#define PERSIST_RELAY_MIN_INTERVAL_US (10 * 60 * 1000000LL)  // 10 min
 
 #define SAMPLE_PERIOD_TICKS 60 * configTICK_RATE_HZ  // 1 min
 
 #define TEMP_SAMPLE_PERIOD_TICKS 60 * configTICK_RATE_HZ  // 1 min
+#define TEMP_SAMPLE_PERIOD_US (60 * 1000000LL)             // 1 min
+// No good reading for this long and the temperature is flagged as stale
+#define TEMP_SAMPLE_STALE_US (5 * 60 * 1000000LL)  // 5 min
+
+// Outlier rejection on the sample pipeline
+#define SAMPLE_FILTER_WINDOW 9
+#define SAMPLE_FILTER_MIN_COUNT 3  // Accept readings until the window has this
+#define SAMPLE_FILTER_MAD_SCALE 3  // Reject beyond this many sigma
+#define SAMPLE_FILTER_MIN_DEVIATION_RAW 32  // 2 C, 12 bit readings are jumpy
+
+// Voting between redundant probes
+#define FUSION_DISAGREE_RAW 24     // 1.5 C
+#define FUSION_SCORE_MARGIN 0.2f   // Health difference that settles a 2-way tie
+#define FUSION_HEALTH_ALPHA 0.05f  // Running average weight, ~20 samples
+
+// Rolling linear fit to the fused temperature
+#define TREND_WINDOW 60        // Samples, an hour at one a minute
+#define TREND_MIN_SAMPLES 15   // Fewer and there is no trend
+#define TREND_MAX_AGE_S (2 * 60 * 60)  // Older samples leave the window early
+#define TREND_REBASE_S 65536           // Keeps the sums small, see trend.c
+// The predictive policy acts on the line this far ahead when it fits at
+// least this well (r2 in percent), instead of on the current temperature
+#define TREND_LEAD_S (30 * 60)
+#define TREND_MIN_R2_PCT 70
+
+// Freeze exposure: degree-minutes below the freeze danger temp, leaking
+// away with this time constant. A steady deficit of d C settles at
+// d * EXPOSURE_DECAY_S / 60 degree-minutes.
+#define EXPOSURE_DECAY_S (3 * 60 * 60)
+#define EXPOSURE_MAX_STEP_S (5 * 60)  // Longer gaps between samples count this
+// The exposure policy does not circulate below this
+#define EXPOSURE_MIN_DEG_MIN 60  // e.g. 1 C below for an hour
+#define EXPOSURE_LOG_STEP_DEG_MIN 10  // Logged when it moves this much
 
 #define LED_PIN 2
 #define LED_ON_TICKS 250 / portTICK_PERIOD_MS
@@ -31,14 +126,14 @@
 #define MDNS_INSTANCE_NAME "antifreeze"
 
 #define TIME_ZONE "EST5EDT,M3.2.0,M11.1.0"
-#define THE_END_OF_TIME LONG_MAX
+#define THE_END_OF_TIME INT64_MAX  // A monotonic deadline that never comes
+// Any earlier system time means the clock has not been set (2024-01-01)
+#define CLOCK_MIN_VALID_WALL_S 1704067200
 #define NTP_SERVER "pool.ntp.org"
 
 // Overrides for test
 #if CONFIG_TEST_MODE
 
-#define CIRC_ON_TICKS 15 * configTICK_RATE_HZ
-#define MAX_CIRC_INTERVAL_S 60.0
 #define TEMP_SAMPLE_PERIOD_TICKS 60 * configTICK_RATE_HZ
 
 #else
@@ -0,0 +1,126 @@
+#include "eventlog.h"
+
+#include <stdatomic.h>
+
+#include "clock.h"
+#include "constants.h"
+#include "freertos/FreeRTOS.h"
+
+// A record packs, from the top bit down:
+//   3 bits  type
+//  13 bits  seconds since the previous record
+//  16 bits  value
+// A step of 2^13 s (2.3 h) or more goes in an EVENT_GAP record first, which
+// uses the value bits as the top of a 29 bit step.
+#define TYPE_SHIFT 29
+#define DT_SHIFT 16
+#define DT_BITS 13
+#define DT_MAX ((1 << DT_BITS) - 1)
+#define GAP_MAX ((1 << (DT_BITS + 16)) - 1)
+
+static atomic_uint records[EVENTLOG_CAPACITY];
+
+// head counts every record ever appended; the newest is at head - 1. head
+// and newest_s change together under a seqlock, like State.
+static atomic_uint head;
+static int64_t newest_s;
+static atomic_uint log_seq;
+static portMUX_TYPE log_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char* type_names[EVENT_TYPE_COUNT] = {
+    [EVENT_TEMPERATURE] = "temperature",
+    [EVENT_RELAY_ON] = "relay on",
+    [EVENT_RELAY_OFF] = "relay off",
+    [EVENT_BOOT] = "boot",
+    [EVENT_GAP] = "gap",
+    [EVENT_EXPOSURE] = "exposure",
+    [EVENT_SLOW_BOOT] = "slow boot",
+};
+
+static uint32_t pack(EventType type, uint32_t dt_s, uint16_t value) {
+  return ((uint32_t)type << TYPE_SHIFT) | (dt_s << DT_SHIFT) | value;
+}
+
+// Called with the seqlock held
+static void put(uint32_t record) {
+  unsigned h = atomic_load_explicit(&head, memory_order_relaxed);
+  atomic_store_explicit(&records[h % EVENTLOG_CAPACITY], record,
+                        memory_order_relaxed);
+  atomic_store_explicit(&head, h + 1, memory_order_release);
+}
+
+void eventlog_append(EventType type, int16_t value) {
+  int64_t now_s = clock_now_us() / 1000000LL;
+
+  portENTER_CRITICAL(&log_lock);
+  atomic_fetch_add_explicit(&log_seq, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  // The first record's step is from boot
+  int64_t previous_s =
+      atomic_load_explicit(&head, memory_order_relaxed) ? newest_s : 0;
+  int64_t dt_s = now_s > previous_s ? now_s - previous_s : 0;
+  if (dt_s > GAP_MAX) {
+    dt_s = GAP_MAX;  // 17 years
+  }
+  if (dt_s > DT_MAX) {
+    put(pack(EVENT_GAP, dt_s & DT_MAX, dt_s >> DT_BITS));
+    dt_s = 0;
+  }
+  put(pack(type, dt_s, value));
+  newest_s = now_s;
+
+  atomic_thread_fence(memory_order_release);
+  atomic_fetch_add_explicit(&log_seq, 1, memory_order_relaxed);
+  portEXIT_CRITICAL(&log_lock);
+}
+
+size_t eventlog_read(EventVisitor visitor, void* ctx) {
+  unsigned begin, end, h;
+  int64_t time_s;
+  do {
+    begin = atomic_load_explicit(&log_seq, memory_order_acquire);
+    h = atomic_load_explicit(&head, memory_order_relaxed);
+    time_s = newest_s;
+    atomic_thread_fence(memory_order_acquire);
+    end = atomic_load_explicit(&log_seq, memory_order_relaxed);
+  } while ((begin & 1) || begin != end);
+
+  // Walk back from the newest record, rebuilding times from the steps.
+  // Records are immutable until the writer comes round the ring again, so
+  // each one is checked against head after it is read.
+  size_t visited = 0;
+  for (unsigned i = h; i-- > 0 && h - i <= EVENTLOG_CAPACITY;) {
+    uint32_t record = atomic_load_explicit(&records[i % EVENTLOG_CAPACITY],
+                                           memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&head, memory_order_relaxed) >=
+        i + EVENTLOG_CAPACITY) {
+      break;  // Overwritten while we were reading
+    }
+
+    EventType type = record >> TYPE_SHIFT;
+    uint32_t dt_s = (record >> DT_SHIFT) & DT_MAX;
+    uint16_t value = record & 0xffff;
+    if (type == EVENT_GAP) {
+      time_s -= ((uint32_t)value << DT_BITS) | dt_s;
+      continue;
+    }
+    Event event = {
+        .type = type, .seq = i, .time_s = time_s, .value = (int16_t)value};
+    visited++;
+    if (!visitor(&event, ctx)) {
+      break;
+    }
+    time_s -= dt_s;
+  }
+  return visited;
+}
+
+uint32_t eventlog_head() {
+  return atomic_load_explicit(&head, memory_order_acquire);
+}
+
+const char* event_type_name(EventType type) {
+  return type < EVENT_TYPE_COUNT ? type_names[type] : "unknown";
+}
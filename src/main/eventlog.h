@@ -0,0 +1,52 @@
+/*
+ * Log of temperatures and relay activations in a fixed-size RAM ring of
+ * packed 4 byte records. One append is O(1) and readers never block or
+ * take a lock.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _EVENTLOG_H_
+#define _EVENTLOG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// At most 8 types: the record has 3 bits for it
+typedef enum {
+  EVENT_TEMPERATURE = 0,  // Fused outside temperature, raw 1/16 C
+  EVENT_RELAY_ON,         // Outside temperature at activation, raw 1/16 C
+  EVENT_RELAY_OFF,        // Measured pulse width, s
+  EVENT_BOOT,             // Reset reason
+  EVENT_GAP,              // Internal, carries a long time step
+  EVENT_EXPOSURE,         // Freeze exposure, whole degree-minutes
+  EVENT_SLOW_BOOT,        // First decision after the budget, 0.1 s, or -1
+                          // if there was none by then
+  EVENT_TYPE_COUNT,
+} EventType;
+
+typedef struct {
+  EventType type;
+  uint32_t seq;    // Position in the log since boot, for readers that resume
+  int64_t time_s;  // Monotonic, seconds since boot
+  int16_t value;
+} Event;
+
+// Safe from any task or esp_timer callback, not from an ISR
+void eventlog_append(EventType, int16_t value);
+
+// Calls the visitor for each event, newest first, until it returns false
+// or the log runs out. Returns the number of events visited.
+typedef bool (*EventVisitor)(const Event*, void* ctx);
+size_t eventlog_read(EventVisitor, void* ctx);
+
+// The seq the next record will get
+uint32_t eventlog_head();
+
+const char* event_type_name(EventType);
+
+#endif  // _EVENTLOG_H_
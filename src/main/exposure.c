@@ -0,0 +1,27 @@
+#include "exposure.h"
+
+void exposure_init(Exposure* e, int32_t exposure) {
+  *e = (Exposure){.value = (int64_t)exposure * 60};
+}
+
+void exposure_add(Exposure* e, int64_t time_s, Temp16 temp, Temp16 threshold,
+                  int32_t decay_s) {
+  int64_t dt = e->started ? time_s - e->last_s : 0;
+  e->started = true;
+  e->last_s = time_s;
+  if (dt <= 0) {
+    return;
+  }
+  // Nothing is known about the temperature in a long gap
+  if (dt > EXPOSURE_MAX_STEP_S) {
+    dt = EXPOSURE_MAX_STEP_S;
+  }
+  // One Euler step of dE/dt = deficit - E / decay. Stable as long as a step
+  // is shorter than the time constant.
+  if (decay_s > 0) {
+    e->value -= e->value * (dt < decay_s ? dt : decay_s) / decay_s;
+  }
+  if (temp < threshold) {
+    e->value += (int64_t)(threshold - temp) * dt;
+  }
+}
@@ -0,0 +1,57 @@
+/*
+ * Freeze exposure: the running integral of how far the temperature has been
+ * below the freeze danger temp, in degree-minutes, leaking away with a time
+ * constant. A long mildly cold night builds up far more of it than a brief
+ * dip. Pure C, no FreeRTOS, so it can also be built on a host.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _EXPOSURE_H_
+#define _EXPOSURE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "sample.h"
+
+// Integer degree-minutes, as 1/16 C minutes
+#define EXPOSURE_PER_DEG_MIN SAMPLE_RAW_PER_C
+
+typedef struct {
+  int64_t value;  // 1/16 C seconds
+  int64_t last_s;
+  bool started;
+} Exposure;
+
+// Starts from a saved value, e.g. 0 or one restored after a reset
+void exposure_init(Exposure*, int32_t exposure);
+
+// Adds the time since the last sample at this temperature, after the
+// leak. Times are seconds on a clock that does not jump. A decay_s of 0
+// means no leak.
+void exposure_add(Exposure*, int64_t time_s, Temp16 temp, Temp16 threshold,
+                  int32_t decay_s);
+
+// 1/16 C minutes
+static inline int32_t exposure_get(const Exposure* e) {
+  int64_t v = e->value / 60;
+  return v > INT32_MAX ? INT32_MAX : v;
+}
+
+// The steady deficit below the threshold that would build up this much
+// exposure: a smoothed "how far below", in 1/16 C
+static inline Temp16 exposure_sustained_deficit(int32_t exposure,
+                                                int32_t decay_s) {
+  if (decay_s <= 0) {
+    return 0;
+  }
+  int64_t d = (int64_t)exposure * 60 / decay_s;
+  return d > INT16_MAX ? INT16_MAX : d;
+}
+
+#endif  // _EXPOSURE_H_
@@ -0,0 +1,594 @@
+#include "flashlog.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock.h"
+#include "constants.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "eventlog.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char* TAG = "flashlog";
+
+#define SECTOR_SIZE 4096
+#define PAGE_SIZE 256
+#define ERASED 0xff
+#define SECTOR_MAGIC 0xa17f1096
+#define SECTOR_VERSION 1
+#define ALIGN4(n) (((n) + 3) & ~3)
+#define BLOCK_DATA_MAX \
+  (PAGE_SIZE - sizeof(FlashLogHeader) - sizeof(FlashLogBlock))
+#define BLOCK_DATA_MIN 32  // Less room than this left on a page: use the next
+// How long after its time a record can reach flash: the flush deadline,
+// with a margin for the check period and a backlog
+#define SKEW_S (FLASHLOG_MAX_DELAY_US / 1000000 + 10 * 60)
+
+// First 16 bytes of every sector in use. seq goes up by one for each sector
+// written, so the newest sector has the highest.
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t version;
+  uint32_t crc;  // CRC32 of the fields above
+} SectorHeader;
+
+static const esp_partition_t* partition;
+static uint32_t sector_count;
+
+// The seek index: wall clock time of the first record in each sector, 0 if
+// unknown. It is kept in the log itself, as those records, and read back at
+// boot. A sector holds a few days of compressed temperatures, so a range
+// query reads at most a couple of sectors it does not need.
+static atomic_uint* sector_first_s;
+
+// Where the writer is. Readers use the current sector to find the oldest.
+static atomic_uint current_sector;
+static atomic_uint current_seq;
+static size_t write_offset;  // Within the current sector
+
+// The page being filled: where it starts in the sector and how much of it
+// is already in flash
+static uint8_t page[PAGE_SIZE];
+static size_t page_base;
+static size_t page_flushed;
+
+// The temperature block being filled, sized to end with the page it will be
+// written to, and the other events waiting for it to close
+static uint8_t block_record[sizeof(FlashLogBlock) + BLOCK_DATA_MAX];
+static TempEncoder block;
+static bool block_open;
+static uint8_t block_flags;
+static Event pending[FLASHLOG_PENDING];
+static int pending_count;
+
+static uint32_t event_cursor;  // Next RAM event log seq to move to flash
+static int64_t last_flush_us;
+
+static uint32_t header_crc(const SectorHeader* h) {
+  return esp_rom_crc32_le(0, (const uint8_t*)h, offsetof(SectorHeader, crc));
+}
+
+static bool header_valid(const SectorHeader* h) {
+  return h->magic == SECTOR_MAGIC && h->version == SECTOR_VERSION &&
+         h->crc == header_crc(h);
+}
+
+static uint8_t record_crc(const FlashLogHeader* r) {
+  uint8_t crc = esp_rom_crc8_le(0, (const uint8_t*)r, 3);
+  return esp_rom_crc8_le(crc, (const uint8_t*)(r + 1), r->length);
+}
+
+// Finds the next intact record at or after *offset in a mapped sector and
+// moves *offset past it. Returns NULL at the end of the data, with *offset
+// where the next record would go.
+//
+// The writer never lets a record cross a page. When one does not fit it
+// leaves the rest of the page erased and starts the next, and after a torn
+// write it also moves on to the next page. So an erased or bad record means
+// "try the next page", and the data ends at an erased byte followed by an
+// erased page.
+static const FlashLogHeader* next_record(const uint8_t* sector,
+                                         size_t* offset) {
+  while (*offset + sizeof(FlashLogHeader) <= SECTOR_SIZE) {
+    const FlashLogHeader* r = (const FlashLogHeader*)(sector + *offset);
+    size_t page_end = (*offset / PAGE_SIZE + 1) * PAGE_SIZE;
+    if (r->type == ERASED) {
+      if (page_end >= SECTOR_SIZE || sector[page_end] == ERASED) {
+        return NULL;
+      }
+      *offset = page_end;
+      continue;
+    }
+    size_t length = sizeof(FlashLogHeader) + r->length;
+    if (*offset + length > page_end || r->crc != record_crc(r)) {
+      *offset = page_end;
+      continue;
+    }
+    *offset += ALIGN4(length);
+    return r;
+  }
+  *offset = SECTOR_SIZE;
+  return NULL;
+}
+
+// Maps one sector for reading. Returns NULL if it does not hold a valid
+// header with the given seq, or any seq if seq is NULL.
+static const uint8_t* map_sector(uint32_t sector, const uint32_t* seq,
+                                 esp_partition_mmap_handle_t* handle) {
+  const void* data;
+  if (esp_partition_mmap(partition, sector * SECTOR_SIZE, SECTOR_SIZE,
+                         ESP_PARTITION_MMAP_DATA, &data, handle) != ESP_OK) {
+    return NULL;
+  }
+  const SectorHeader* h = data;
+  if (!header_valid(h) || (seq && h->seq != *seq)) {
+    esp_partition_munmap(*handle);
+    return NULL;
+  }
+  return data;
+}
+
+// Wall clock time of a record, false for one made before the clock was set
+static bool record_time(const FlashLogHeader* r, uint32_t* time_s) {
+  if (r->flags & FLASHLOG_FLAG_MONOTONIC) {
+    return false;
+  }
+  if (r->type == FLASHLOG_TYPE_TEMPERATURE_BLOCK) {
+    TempDecoder decoder;
+    int16_t raw;
+    flashlog_block_decoder(r, r + 1, &decoder);
+    return temp_decode(&decoder, time_s, &raw);
+  }
+  if (r->length < sizeof(FlashLogEvent)) {
+    return false;
+  }
+  *time_s = ((const FlashLogEvent*)(r + 1))->time_s;
+  return true;
+}
+
+// Index entry from the first page of a sector
+static uint32_t first_record_time(const uint8_t* first_page) {
+  const FlashLogHeader* r =
+      (const FlashLogHeader*)(first_page + sizeof(SectorHeader));
+  uint32_t time_s;
+  if (r->type == ERASED ||
+      sizeof(SectorHeader) + sizeof(FlashLogHeader) + r->length > PAGE_SIZE ||
+      r->crc != record_crc(r) || !record_time(r, &time_s)) {
+    return 0;
+  }
+  return time_s;
+}
+
+static esp_err_t start_sector(uint32_t sector, uint32_t seq) {
+  atomic_store(&sector_first_s[sector], 0);
+  esp_err_t err =
+      esp_partition_erase_range(partition, sector * SECTOR_SIZE, SECTOR_SIZE);
+  if (err != ESP_OK) {
+    return err;
+  }
+  SectorHeader h = {
+      .magic = SECTOR_MAGIC, .seq = seq, .version = SECTOR_VERSION};
+  h.crc = header_crc(&h);
+  err = esp_partition_write(partition, sector * SECTOR_SIZE, &h, sizeof(h));
+  if (err != ESP_OK) {
+    return err;
+  }
+  atomic_store(&current_seq, seq);
+  atomic_store(&current_sector, sector);
+  write_offset = sizeof(SectorHeader);
+  page_base = 0;
+  page_flushed = write_offset;
+  memset(page, ERASED, sizeof(page));
+  return ESP_OK;
+}
+
+esp_err_t flashlog_init() {
+  partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, FLASHLOG_PARTITION_SUBTYPE, FLASHLOG_PARTITION);
+  if (partition == NULL) {
+    ESP_LOGW(TAG, "No \"" FLASHLOG_PARTITION "\" partition, flash log off");
+    return ESP_ERR_NOT_FOUND;
+  }
+  sector_count = partition->size / SECTOR_SIZE;
+  sector_first_s = calloc(sector_count, sizeof(atomic_uint));
+  if (sector_first_s == NULL) {
+    partition = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+
+  // The newest sector is the one with the highest seq. First pages are
+  // read, not mapped, so this is quick even for a large partition.
+  static uint8_t first_page[PAGE_SIZE];
+  bool found = false;
+  uint32_t newest = 0;
+  uint32_t newest_seq = 0;
+  for (uint32_t s = 0; s < sector_count; s++) {
+    const SectorHeader* h = (const SectorHeader*)first_page;
+    if (esp_partition_read(partition, s * SECTOR_SIZE, first_page,
+                           PAGE_SIZE) != ESP_OK ||
+        !header_valid(h)) {
+      continue;
+    }
+    atomic_store(&sector_first_s[s], first_record_time(first_page));
+    if (!found || h->seq > newest_seq) {
+      found = true;
+      newest = s;
+      newest_seq = h->seq;
+    }
+  }
+  if (!found) {
+    ESP_LOGI(TAG, "Empty log, starting at sector 0");
+    return start_sector(0, 0);
+  }
+
+  // Carry on after the last intact record, on a fresh page if the last one
+  // was left part written
+  esp_partition_mmap_handle_t handle;
+  const uint8_t* sector = map_sector(newest, &newest_seq, &handle);
+  if (sector == NULL) {
+    return ESP_FAIL;
+  }
+  size_t offset = sizeof(SectorHeader);
+  size_t records = 0;
+  while (next_record(sector, &offset)) {
+    records++;
+  }
+  esp_partition_munmap(handle);
+
+  atomic_store(&current_seq, newest_seq);
+  atomic_store(&current_sector, newest);
+  write_offset = offset;
+  page_base = offset / PAGE_SIZE * PAGE_SIZE;
+  page_flushed = offset - page_base;
+  memset(page, ERASED, sizeof(page));
+  ESP_LOGI(TAG, "Resuming at sector %lu (seq %lu) offset %u, %u records",
+           (unsigned long)newest, (unsigned long)newest_seq,
+           (unsigned)write_offset, (unsigned)records);
+  return ESP_OK;
+}
+
+// Writes the part of the page not yet in flash. Erased bytes can be
+// programmed later, so a page may be written in several goes, and a failed
+// write tried again.
+static esp_err_t flush_page() {
+  size_t fill = write_offset - page_base;
+  if (fill <= page_flushed) {
+    return ESP_OK;
+  }
+  size_t address =
+      atomic_load(&current_sector) * SECTOR_SIZE + page_base + page_flushed;
+  esp_err_t err = esp_partition_write(partition, address, page + page_flushed,
+                                      fill - page_flushed);
+  if (err == ESP_OK) {
+    page_flushed = fill;
+  }
+  return err;
+}
+
+// Adds one record to the page buffer, moving to a new page or sector first
+// if it does not fit
+static esp_err_t append_record(const FlashLogHeader* header,
+                               const void* payload) {
+  size_t length = ALIGN4(sizeof(FlashLogHeader) + header->length);
+  if (write_offset + length > page_base + PAGE_SIZE ||
+      write_offset + length > SECTOR_SIZE) {
+    esp_err_t err = flush_page();
+    if (err != ESP_OK) {
+      return err;
+    }
+    size_t next_page = page_base + PAGE_SIZE;
+    if (next_page + length > SECTOR_SIZE) {
+      uint32_t next = (atomic_load(&current_sector) + 1) % sector_count;
+      err = start_sector(next, atomic_load(&current_seq) + 1);
+      if (err != ESP_OK) {
+        return err;
+      }
+    } else {
+      page_base = next_page;
+      write_offset = next_page;
+      page_flushed = 0;
+      memset(page, ERASED, sizeof(page));
+    }
+  }
+  size_t fill = write_offset - page_base;
+  FlashLogHeader* r = (FlashLogHeader*)(page + fill);
+  memcpy(r, header, sizeof(FlashLogHeader));
+  memcpy(r + 1, payload, header->length);
+  r->crc = record_crc(r);
+  uint32_t time_s;
+  if (write_offset == sizeof(SectorHeader) && record_time(r, &time_s)) {
+    atomic_store(&sector_first_s[atomic_load(&current_sector)], time_s);
+  }
+  write_offset += length;
+  return ESP_OK;
+}
+
+// Events not yet in flash, oldest first. Collected newest first, so the
+// array is filled from the back.
+typedef struct {
+  Event events[FLASHLOG_BATCH];
+  int count;
+} Batch;
+
+static bool collect_event(const Event* event, void* ctx) {
+  Batch* batch = ctx;
+  if (event->seq < event_cursor) {
+    return false;
+  }
+  // Keep the oldest: later ones wait for the next round
+  if (batch->count == FLASHLOG_BATCH) {
+    memmove(&batch->events[1], &batch->events[0],
+            (FLASHLOG_BATCH - 1) * sizeof(Event));
+    batch->count--;
+  }
+  batch->events[FLASHLOG_BATCH - 1 - batch->count] = *event;
+  batch->count++;
+  return true;
+}
+
+static void to_flash_time(const Event* event, uint8_t* flags,
+                          uint32_t* time_s) {
+  bool wall = clock_wall_valid();
+  *flags = wall ? 0 : FLASHLOG_FLAG_MONOTONIC;
+  *time_s = wall ? clock_to_wall_s(event->time_s * 1000000LL) : event->time_s;
+}
+
+static esp_err_t append_event(const Event* event) {
+  FlashLogHeader header = {
+      .type = event->type,
+      .length = sizeof(FlashLogEvent),
+  };
+  FlashLogEvent payload = {.value = event->value};
+  to_flash_time(event, &header.flags, &payload.time_s);
+  return append_record(&header, &payload);
+}
+
+static void open_block(uint8_t flags) {
+  int room = (int)(page_base + PAGE_SIZE - write_offset) -
+             (int)(sizeof(FlashLogHeader) + sizeof(FlashLogBlock));
+  if (room < BLOCK_DATA_MIN) {
+    room = BLOCK_DATA_MAX;
+  }
+  temp_encoder_init(&block, block_record + sizeof(FlashLogBlock), room);
+  block_open = true;
+  block_flags = flags;
+}
+
+// Writes the block, then the events that waited for it. On a write error
+// whatever is not yet written is kept, to be tried again.
+static esp_err_t close_block() {
+  if (block_open) {
+    FlashLogHeader header = {
+        .type = FLASHLOG_TYPE_TEMPERATURE_BLOCK,
+        .length = sizeof(FlashLogBlock) + temp_encoder_bytes(&block),
+        .flags = block_flags,
+    };
+    FlashLogBlock* head = (FlashLogBlock*)block_record;
+    *head = (FlashLogBlock){.count = block.count};
+    esp_err_t err = append_record(&header, block_record);
+    if (err != ESP_OK) {
+      return err;
+    }
+    block_open = false;
+  }
+  int written = 0;
+  esp_err_t err = ESP_OK;
+  while (written < pending_count &&
+         (err = append_event(&pending[written])) == ESP_OK) {
+    written++;
+  }
+  memmove(&pending[0], &pending[written],
+          (pending_count - written) * sizeof(Event));
+  pending_count -= written;
+  return err;
+}
+
+// On an error the sample is not taken, and comes again next round
+static esp_err_t add_temperature(const Event* event) {
+  uint8_t flags;
+  uint32_t time_s;
+  to_flash_time(event, &flags, &time_s);
+  if (!block_open || flags != block_flags) {
+    esp_err_t err = close_block();
+    if (err != ESP_OK) {
+      return err;
+    }
+    open_block(flags);
+  }
+  if (!temp_encode(&block, time_s, event->value)) {
+    esp_err_t err = close_block();
+    if (err != ESP_OK) {
+      return err;
+    }
+    open_block(flags);
+    temp_encode(&block, time_s, event->value);
+  }
+  return ESP_OK;
+}
+
+// Events wait behind an open block, or behind ones a write error held back
+static esp_err_t add_event(const Event* event) {
+  if (pending_count == FLASHLOG_PENDING) {
+    esp_err_t err = close_block();
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  if (!block_open && pending_count == 0) {
+    return append_event(event);
+  }
+  pending[pending_count++] = *event;
+  return ESP_OK;
+}
+
+// Full pages are written as they fill. The rest, including any open block,
+// waits until the oldest of it is FLASHLOG_MAX_DELAY_US old.
+static esp_err_t flush_events(bool force) {
+  static Batch batch;
+  batch.count = 0;
+  eventlog_read(collect_event, &batch);
+
+  const Event* events = &batch.events[FLASHLOG_BATCH - batch.count];
+  for (int i = 0; i < batch.count; i++) {
+    esp_err_t err = events[i].type == EVENT_TEMPERATURE
+                        ? add_temperature(&events[i])
+                        : add_event(&events[i]);
+    if (err != ESP_OK) {
+      return err;
+    }
+    event_cursor = events[i].seq + 1;
+  }
+  if (!force) {
+    return ESP_OK;
+  }
+  last_flush_us = clock_now_us();
+  esp_err_t err = close_block();
+  if (err != ESP_OK) {
+    return err;
+  }
+  return flush_page();
+}
+
+void flashlog_task() {
+  if (partition == NULL) {
+    vTaskDelete(NULL);
+  }
+  memset(page, ERASED, sizeof(page));
+  last_flush_us = clock_now_us();
+  while (true) {
+    vTaskDelay(FLASHLOG_CHECK_TICKS);
+    // Records lost from the RAM ring before they got here stay lost
+    uint32_t head = eventlog_head();
+    if (head - event_cursor > EVENTLOG_CAPACITY) {
+      event_cursor = head - EVENTLOG_CAPACITY;
+    }
+    bool force = clock_now_us() - last_flush_us > FLASHLOG_MAX_DELAY_US;
+    esp_err_t err = flush_events(force);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Write failed: %s", esp_err_to_name(err));
+    }
+  }
+}
+
+// Sectors in age order: the one after the current sector is the oldest
+// once the ring has wrapped. Its seq tells us whether it has.
+static uint32_t oldest_seq(uint32_t* sector) {
+  uint32_t current = atomic_load(&current_sector);
+  uint32_t seq = atomic_load(&current_seq);
+  uint32_t used = seq + 1 < sector_count ? seq + 1 : sector_count;
+  *sector = (current + sector_count - (used - 1)) % sector_count;
+  return seq - (used - 1);
+}
+
+// The run of sectors, oldest first, that can hold records from from_s to
+// to_s. A record reaches flash at most SKEW_S after its time, so every
+// record before a sector is at most SKEW_S newer than the sector's first,
+// and every record from it on at most SKEW_S older.
+typedef struct {
+  uint32_t sector;
+  uint32_t seq;
+  uint32_t count;
+} SectorSpan;
+
+static SectorSpan sectors_for(uint32_t from_s, uint32_t to_s) {
+  SectorSpan span;
+  span.seq = oldest_seq(&span.sector);
+  uint32_t count = atomic_load(&current_seq) - span.seq + 1;
+  uint32_t first = 0;
+  uint32_t end = count;
+  uint32_t s = span.sector;
+  for (uint32_t i = 0; i < count; i++, s = (s + 1) % sector_count) {
+    int64_t first_s = atomic_load(&sector_first_s[s]);
+    if (first_s == 0) {
+      continue;  // Clock not set, or the first record was torn
+    }
+    if (first_s - SKEW_S > to_s) {
+      end = i;
+      break;
+    }
+    if (first_s + SKEW_S < from_s) {
+      first = i;
+    }
+  }
+  span.sector = (span.sector + first) % sector_count;
+  span.seq += first;
+  span.count = end - first;
+  return span;
+}
+
+size_t flashlog_read_range(uint32_t from_s, uint32_t to_s,
+                           FlashLogVisitor visitor, void* ctx) {
+  if (partition == NULL) {
+    return 0;
+  }
+  SectorSpan span = sectors_for(from_s, to_s);
+  uint32_t s = span.sector;
+  size_t visited = 0;
+  for (uint32_t seq = span.seq; seq != span.seq + span.count;
+       seq++, s = (s + 1) % sector_count) {
+    esp_partition_mmap_handle_t handle;
+    const uint8_t* sector = map_sector(s, &seq, &handle);
+    if (sector == NULL) {
+      continue;  // Being erased, or never finished
+    }
+    size_t offset = sizeof(SectorHeader);
+    const FlashLogHeader* r;
+    bool more = true;
+    while (more && (r = next_record(sector, &offset))) {
+      visited++;
+      more = visitor(r, r + 1, ctx);
+    }
+    esp_partition_munmap(handle);
+    if (!more) {
+      break;
+    }
+  }
+  return visited;
+}
+
+size_t flashlog_read(FlashLogVisitor visitor, void* ctx) {
+  return flashlog_read_range(0, UINT32_MAX, visitor, ctx);
+}
+
+void flashlog_block_decoder(const FlashLogHeader* header, const void* payload,
+                            TempDecoder* decoder) {
+  const FlashLogBlock* block = payload;
+  temp_decoder_init(decoder, (const uint8_t*)(block + 1),
+                    header->length - sizeof(FlashLogBlock), block->count);
+}
+
+esp_err_t flashlog_stream_range(uint32_t from_s, uint32_t to_s,
+                                FlashLogSink sink, void* ctx) {
+  if (partition == NULL) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  SectorSpan span = sectors_for(from_s, to_s);
+  uint32_t s = span.sector;
+  for (uint32_t seq = span.seq; seq != span.seq + span.count;
+       seq++, s = (s + 1) % sector_count) {
+    esp_partition_mmap_handle_t handle;
+    const uint8_t* sector = map_sector(s, &seq, &handle);
+    if (sector == NULL) {
+      continue;
+    }
+    // Up to the end of the data; the reader finds records as we do
+    size_t offset = sizeof(SectorHeader);
+    while (next_record(sector, &offset)) {
+    }
+    bool more = sink(sector, offset, ctx);
+    esp_partition_munmap(handle);
+    if (!more) {
+      break;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t flashlog_stream(FlashLogSink sink, void* ctx) {
+  return flashlog_stream_range(0, UINT32_MAX, sink, ctx);
+}
@@ -0,0 +1,88 @@
+/*
+ * Long term history in a dedicated flash partition. Records from the RAM
+ * event log are appended a page at a time to a ring of sectors; the oldest
+ * sector is erased when the ring comes round. Each record has its own CRC,
+ * so a write cut short by a power loss costs only that record. Readers see
+ * the records in memory mapped flash, without copying them.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _FLASHLOG_H_
+#define _FLASHLOG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compress.h"
+#include "esp_err.h"
+
+// Record layout in flash, all little endian. Records are 4 byte aligned and
+// never cross a 256 byte page.
+typedef struct {
+  uint8_t type;    // EventType, FLASHLOG_TYPE_*, or 0xff in erased flash
+  uint8_t length;  // Payload bytes that follow the header
+  uint8_t flags;
+  uint8_t crc;  // CRC8 of the other three header bytes and the payload
+} FlashLogHeader;
+
+// time_s is seconds since boot, not since the epoch: the clock was not set
+#define FLASHLOG_FLAG_MONOTONIC 0x01
+
+// Payload of an event record
+typedef struct {
+  uint32_t time_s;  // Unix time, or see FLASHLOG_FLAG_MONOTONIC
+  int16_t value;    // As in Event
+  uint16_t reserved;
+} FlashLogEvent;
+
+// Temperatures are stored in compressed blocks rather than one record each
+#define FLASHLOG_TYPE_TEMPERATURE_BLOCK 0x10
+
+// Payload of a block record: this header, then count samples from a
+// TempEncoder (compress.h) filling the rest of the record. Other events
+// that arrive while a block is filling are written after it, so records
+// are not strictly in time order.
+typedef struct {
+  uint16_t count;
+  uint16_t reserved;
+} FlashLogBlock;
+
+// Finds the partition and where writing left off. The log is disabled,
+// not fatal, if there is no partition.
+esp_err_t flashlog_init();
+
+// Moves records from the RAM event log to flash, a page at a time, or
+// after FLASHLOG_MAX_DELAY_US at the latest. Never returns.
+void flashlog_task();
+
+// Visits each intact record, oldest first. Header and payload point into
+// mapped flash and are only valid during the call.
+typedef bool (*FlashLogVisitor)(const FlashLogHeader*, const void* payload,
+                                void* ctx);
+size_t flashlog_read(FlashLogVisitor, void* ctx);
+
+// As flashlog_read, but seeks straight to the sectors that can hold records
+// from from_s to to_s (Unix time) and stops after them. Records either side
+// of the range, or made before the clock was set, still come through:
+// check the times.
+size_t flashlog_read_range(uint32_t from_s, uint32_t to_s, FlashLogVisitor,
+                           void* ctx);
+
+// Sets up a decoder for the samples in a block record
+void flashlog_block_decoder(const FlashLogHeader*, const void* payload,
+                            TempDecoder*);
+
+// Hands out the used part of each sector, oldest first, straight from
+// mapped flash, e.g. to send it over HTTP. Stops if the sink returns false.
+typedef bool (*FlashLogSink)(const void* data, size_t length, void* ctx);
+esp_err_t flashlog_stream(FlashLogSink, void* ctx);
+// Only the sectors flashlog_read_range would read
+esp_err_t flashlog_stream_range(uint32_t from_s, uint32_t to_s, FlashLogSink,
+                                void* ctx);
+
+#endif  // _FLASHLOG_H_
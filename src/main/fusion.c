@@ -0,0 +1,107 @@
+#include "fusion.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void probe_init(Probe* p, const uint8_t rom_code[8]) {
+  memset(p, 0, sizeof(*p));
+  sample_pipeline_init(&p->pipeline);
+  memcpy(p->health.rom_code, rom_code, sizeof(p->health.rom_code));
+  p->health.score = 1.0f;
+  p->health.flags = PROBE_STALE;
+  p->last_status = SAMPLE_READ_ERROR;
+}
+
+SampleStatus probe_push(Probe* p, const Sample* s) {
+  p->last_status = sample_pipeline_push(&p->pipeline, s);
+  p->health.reads++;
+  if (p->last_status == SAMPLE_OK) {
+    p->health.raw = s->raw;
+  } else {
+    p->health.rejects++;
+  }
+  return p->last_status;
+}
+
+static int16_t median3(int16_t a, int16_t b, int16_t c) {
+  if (a > b) {
+    int16_t t = a;
+    a = b;
+    b = t;
+  }
+  return c < a ? a : (c > b ? b : c);
+}
+
+static FusedTemp fuse_two(const Probe* a, const Probe* b) {
+  FusedTemp fused = {.valid = true, .contributors = 2};
+  int16_t ra = a->health.raw;
+  int16_t rb = b->health.raw;
+  if (abs(ra - rb) <= FUSION_DISAGREE_RAW) {
+    float wa = a->health.score + 0.01f;
+    float wb = b->health.score + 0.01f;
+    fused.raw = (int16_t)((wa * ra + wb * rb) / (wa + wb) + 0.5f);
+    return fused;
+  }
+
+  fused.contributors = 1;
+  float margin = a->health.score - b->health.score;
+  if (margin > FUSION_SCORE_MARGIN) {
+    fused.raw = ra;
+  } else if (margin < -FUSION_SCORE_MARGIN) {
+    fused.raw = rb;
+  } else {
+    fused.raw = ra < rb ? ra : rb;
+  }
+  return fused;
+}
+
+static void update_health(Probe* p, const FusedTemp* fused, bool live) {
+  ProbeHealth* h = &p->health;
+  h->flags = live ? 0 : PROBE_STALE;
+
+  bool good = live && p->last_status == SAMPLE_OK;
+  if (good && fused->valid) {
+    int deviation = abs(h->raw - fused->raw);
+    if (deviation > FUSION_DISAGREE_RAW) {
+      h->flags |= PROBE_DISAGREES;
+      h->disagreements++;
+      good = false;
+    }
+    h->deviation_c += FUSION_HEALTH_ALPHA *
+                      (sample_raw_to_c(deviation) - h->deviation_c);
+  }
+  h->score += FUSION_HEALTH_ALPHA * ((good ? 1.0f : 0.0f) - h->score);
+}
+
+FusedTemp fuse_probes(Probe probes[], int count, int64_t now_us) {
+  Probe* live[TEMP_SENSOR_MAX_PROBES];
+  bool is_live[TEMP_SENSOR_MAX_PROBES] = {false};
+  int n = 0;
+  for (int i = 0; i < count; i++) {
+    is_live[i] = !sample_pipeline_is_stale(&probes[i].pipeline, now_us,
+                                           TEMP_SAMPLE_STALE_US);
+    if (is_live[i]) {
+      live[n++] = &probes[i];
+    }
+  }
+
+  FusedTemp fused = {.valid = false};
+  if (n == 1) {
+    fused = (FusedTemp){
+        .valid = true, .raw = live[0]->health.raw, .contributors = 1};
+  } else if (n == 2) {
+    fused = fuse_two(live[0], live[1]);
+  } else if (n >= 3) {
+    fused = (FusedTemp){
+        .valid = true,
+        .raw = median3(live[0]->health.raw, live[1]->health.raw,
+                       live[2]->health.raw),
+        .contributors = 3};
+  }
+
+  for (int i = 0; i < count; i++) {
+    update_health(&probes[i], &fused, is_live[i]);
+    fused.fresh |= fused.valid && probes[i].last_status == SAMPLE_OK;
+  }
+  return fused;
+}
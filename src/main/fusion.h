@@ -0,0 +1,60 @@
+/*
+ * Fuses readings from redundant outdoor probes into one temperature and
+ * keeps running health statistics for each probe. Pure C, no FreeRTOS.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _FUSION_H_
+#define _FUSION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "sample.h"
+
+#ifndef BIT
+#define BIT(n) (1u << (n))
+#endif
+
+// Probe flags
+#define PROBE_STALE BIT(0)      // No good reading for TEMP_SAMPLE_STALE_US
+#define PROBE_DISAGREES BIT(1)  // Too far from the fused temperature
+
+typedef struct {
+  uint8_t rom_code[8];
+  int16_t raw;  // Last good reading, 1/16 C
+  uint8_t flags;
+  uint32_t reads;
+  uint32_t rejects;        // Read errors and outliers
+  uint32_t disagreements;  // Good reads that disagreed with the others
+  float score;             // Running average of good and agreeing reads, 0-1
+  float deviation_c;       // Running average distance from the fused value
+} ProbeHealth;
+
+typedef struct {
+  SamplePipeline pipeline;
+  SampleStatus last_status;
+  ProbeHealth health;
+} Probe;
+
+typedef struct {
+  bool valid;  // Some probe had a good reading within TEMP_SAMPLE_STALE_US
+  bool fresh;  // Some probe's latest push was good: a new reading
+  int16_t raw;  // 1/16 C
+  uint8_t contributors;
+} FusedTemp;
+
+void probe_init(Probe*, const uint8_t rom_code[8]);
+SampleStatus probe_push(Probe*, const Sample*);
+
+// Median of three or more live probes. With two, a weighted mean if they
+// agree, otherwise the healthier one, and the colder one on a tie since a
+// spurious run is cheaper than a missed one. Updates every probe's health.
+FusedTemp fuse_probes(Probe probes[], int count, int64_t now_us);
+
+#endif  // _FUSION_H_
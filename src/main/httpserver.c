@@ -2,6 +2,7 @@
  * Manages the simple http server for the program
  */
 
+#include <ctype.h>
 #include <esp_http_server.h>
 #include <esp_log.h>
 #include <esp_system.h>
@@ -12,19 +13,28 @@
 #include <sys/param.h>
 #include <unistd.h>
 
+#include "boot.h"
+#include "clock.h"
 #include "esp_event.h"
 #include "esp_netif.h"
+#include "eventlog.h"
+#include "exposure.h"
+#include "flashlog.h"
+#include "metrics.h"
+#include "profile.h"
+#include "owb.h"
 #include "state.h"
+#include "summary.h"
 
 #define EXAMPLE_HTTP_QUERY_KEY_MAX_LEN (64)
 #define IDLE_TICKS 5 * configTICK_RATE_HZ
+#define EVENTS_ON_PAGE 10
+#define EVENT_LINE_LEN 64
+#define POLICY_PAGE_LEN 3072
+#define POLICY_FORM_LEN 512
 
 static const char* TAG = "HTTP server";
 
-// TOOD: Maybe this should be part of state ...
-// Currently initialized when the http server is started
-time_t boot_time;
-
 // https://stackoverflow.com/a/16043969
 char* root_page_template =
     "<head>"
@@ -39,36 +49,185 @@ char* root_page_template =
     "</head>"
     "<body>"
     "<hr>"
-    "Outside temp:         %0.1f C</br>"
+    "Outside temp:         %0.1f C%s</br>"
+    "Trend:                %s</br>"
+    "Freeze exposure:      %ld C min</br>"
     "Freeze danger temp:   %0.1f C</br>"
     "Relay last activated: %s </br>"
     "<hr>"
-    "Antifreeze up since:  %s"
-    "<p><a href=\"/relay_test\">Relay test</a></p>"
+    "%s"
+    "<hr>"
+    "%s"
+    "<hr>"
+    "Antifreeze up since:  %s</br>"
+    "Sample jitter:        %lld us mean, %lld us max, %lu missed</br>"
+    "Relay pulse:          %lld us last, %lld-%lld us range, %lu pulses</br>"
+    "Clock:                %lu syncs, error %lld us, drift %0.1f ppm</br>"
+    "Boot:                 %s%s"
+    "<p><a href=\"/log\">Log</a> "
+    "<a href=\"/relay_test\">Relay test</a> "
+    "<a href=\"/metrics\">Metrics</a> "
+    "<a href=\"/profile\">Profile</a> "
+    "<a href=\"/policy\">Policy</a> "
+    "<a href=\"/rollup\">Hours</a> "
+    "<a href=\"/rollup?tier=day\">Days</a></p>"
     "</body>";
 
+// e.g. "Sat Jan  6 06:00:00 2024 temperature -3.2 C"
+static void format_event(const Event* event, char* buf, size_t size) {
+  char time_buf[32];
+  if (clock_wall_valid()) {
+    time_t t = clock_to_wall_s(event->time_s * 1000000LL);
+    struct tm timeinfo;
+    localtime_r(&t, &timeinfo);
+    strftime(time_buf, sizeof(time_buf), "%c", &timeinfo);
+  } else {
+    snprintf(time_buf, sizeof(time_buf), "%llds after boot",
+             (long long)event->time_s);
+  }
+  switch (event->type) {
+    case EVENT_TEMPERATURE:
+    case EVENT_RELAY_ON:
+      snprintf(buf, size, "%s %s %0.1f C", time_buf,
+               event_type_name(event->type), sample_raw_to_c(event->value));
+      break;
+    case EVENT_RELAY_OFF:
+      snprintf(buf, size, "%s %s after %d s", time_buf,
+               event_type_name(event->type), event->value);
+      break;
+    case EVENT_EXPOSURE:
+      snprintf(buf, size, "%s %s %d C min", time_buf,
+               event_type_name(event->type), event->value);
+      break;
+    case EVENT_SLOW_BOOT:
+      if (event->value < 0) {
+        snprintf(buf, size, "%s %s, no decision", time_buf,
+                 event_type_name(event->type));
+      } else {
+        snprintf(buf, size, "%s %s, decision at %0.1f s", time_buf,
+                 event_type_name(event->type), event->value / 10.0);
+      }
+      break;
+    default:
+      snprintf(buf, size, "%s %s %d", time_buf, event_type_name(event->type),
+               event->value);
+      break;
+  }
+}
+
+typedef struct {
+  char* buf;
+  size_t size;
+  size_t len;
+  int lines;
+} EventLines;
+
+static bool append_event_line(const Event* event, void* ctx) {
+  EventLines* lines = ctx;
+  char line[EVENT_LINE_LEN];
+  format_event(event, line, sizeof(line));
+  lines->len += snprintf(lines->buf + lines->len, lines->size - lines->len,
+                         "%s</br>", line);
+  return ++lines->lines < EVENTS_ON_PAGE && lines->len < lines->size;
+}
+
 /* Serves the info page */
 static esp_err_t root_get_handler(httpd_req_t* req) {
+  int64_t render_start_us = metric_start();
   State state = get_state();
 
+  ClockStats clock = clock_get_stats();
+
+  // Times are kept on the monotonic clock and only converted for display
   struct tm timeinfo;
 
-  char boot_time_buf[64] = "";
-  localtime_r(&boot_time, &timeinfo);
-  strftime(boot_time_buf, sizeof(boot_time_buf), "%c", &timeinfo);
+  char boot_time_buf[64] = "unknown";
+  if (clock_wall_valid()) {
+    time_t boot_time = clock_to_wall_s(0);
+    localtime_r(&boot_time, &timeinfo);
+    strftime(boot_time_buf, sizeof(boot_time_buf), "%c", &timeinfo);
+  }
 
-  char relay_time_buf[64] = "";
-  localtime_r(&state.relay_activated_time_s, &timeinfo);
-  strftime(relay_time_buf, sizeof(relay_time_buf), "%c", &timeinfo);
+  // e.g. "-0.8 C/h (fit 93%), at the freeze danger temp in 42 min"
+  char trend_buf[96] = "not enough samples yet";
+  const TrendEstimate* trend = &state.outside_trend;
+  if (trend->samples >= TREND_MIN_SAMPLES) {
+    int len = snprintf(trend_buf, sizeof(trend_buf), "%+0.1f C/h (fit %u%%)",
+                       sample_raw_to_c(trend->slope_per_hour), trend->r2_pct);
+    if (trend->cross_s != 0 && trend->cross_s != TREND_NEVER) {
+      snprintf(trend_buf + len, sizeof(trend_buf) - len,
+               ", at the freeze danger temp in %ld min",
+               (long)(trend->cross_s / 60));
+    }
+  }
+
+  char relay_time_buf[64] = "never";
+  if (state.relay_activated_us != CLOCK_NEVER_US) {
+    if (clock_wall_valid()) {
+      time_t relay_time = clock_to_wall_s(state.relay_activated_us);
+      localtime_r(&relay_time, &timeinfo);
+      strftime(relay_time_buf, sizeof(relay_time_buf), "%c", &timeinfo);
+    } else {
+      snprintf(relay_time_buf, sizeof(relay_time_buf), "%llds ago",
+               (clock_now_us() - state.relay_activated_us) / 1000000LL);
+    }
+  }
+
+  // One line per probe, e.g. "Probe 28ff641e8316c3a9: -3.2 C, health 0.98"
+  char probes_buf[TEMP_SENSOR_MAX_PROBES * 96] = "";
+  size_t probes_len = 0;
+  for (int i = 0; i < state.probe_count; i++) {
+    const ProbeHealth* h = &state.probe_health[i];
+    OneWireBus_ROMCode rom_code;
+    memcpy(rom_code.bytes, h->rom_code, sizeof(rom_code.bytes));
+    char rom_code_s[OWB_ROM_CODE_STRING_LENGTH];
+    owb_string_from_rom_code(rom_code, rom_code_s, sizeof(rom_code_s));
+    probes_len += snprintf(
+        probes_buf + probes_len, sizeof(probes_buf) - probes_len,
+        "Probe %s: %0.1f C, health %0.2f%s%s</br>", rom_code_s,
+        sample_raw_to_c(h->raw), h->score,
+        (h->flags & PROBE_STALE) ? ", dead" : "",
+        (h->flags & PROBE_DISAGREES) ? ", disagrees" : "");
+  }
+
+  // e.g. "first decision 3.2 s, wifi connected 4.1 s, ..."
+  char boot_buf[BOOT_PHASE_COUNT * 32] = "";
+  size_t boot_len = 0;
+  for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+    int64_t us = boot_phase_us(i);
+    if (us >= 0) {
+      boot_len += snprintf(boot_buf + boot_len, sizeof(boot_buf) - boot_len,
+                           "%s%s %0.1f s", boot_len ? ", " : "",
+                           boot_phase_name(i), us / 1e6);
+    }
+  }
+
+  char events_buf[EVENTS_ON_PAGE * (EVENT_LINE_LEN + 8)] = "";
+  EventLines event_lines = {events_buf, sizeof(events_buf)};
+  eventlog_read(append_event_line, &event_lines);
 
   char* resp;
-  // TODO check for error
-  asprintf(&resp, root_page_template, state.outside_temp_c,
-           state.freeze_danger_temp_c, relay_time_buf, boot_time_buf);
+  int resp_len = asprintf(
+      &resp, root_page_template, sample_raw_to_c(state.outside_temp),
+      state.outside_temp_stale ? " (stale)" : "", trend_buf,
+      (long)(state.freeze_exposure / EXPOSURE_PER_DEG_MIN),
+      sample_raw_to_c(state.freeze_danger_temp), relay_time_buf, probes_buf,
+      events_buf, boot_time_buf, sample_jitter_mean_us(&state.sample_jitter),
+      state.sample_jitter.max_us, state.sample_jitter.missed,
+      state.relay_pulse.last_us, state.relay_pulse.min_us,
+      state.relay_pulse.max_us, state.relay_pulse.count, clock.syncs,
+      clock.error_us, clock.drift_ppm, boot_buf,
+      boot_over_budget() ? " (over budget)" : "");
+  metric_end(METRIC_HTTP_RENDER, render_start_us);
+  if (resp_len < 0) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    return ESP_FAIL;
+  }
 
   httpd_resp_set_type(req, "text/html");
-  httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
-  return ESP_OK;
+  esp_err_t err = httpd_resp_send(req, resp, resp_len);
+  free(resp);
+  return err;
 }
 
 static const httpd_uri_t root = {
@@ -77,9 +236,306 @@ static const httpd_uri_t root = {
     .handler = root_get_handler,
 };
 
+// Streams the whole event log in chunks, newest first
+typedef struct {
+  httpd_req_t* req;
+  char buf[1024];
+  size_t len;
+} LogStream;
+
+static bool stream_event(const Event* event, void* ctx) {
+  LogStream* stream = ctx;
+  if (stream->len + EVENT_LINE_LEN + 1 > sizeof(stream->buf)) {
+    if (httpd_resp_send_chunk(stream->req, stream->buf, stream->len) !=
+        ESP_OK) {
+      return false;  // Client went away
+    }
+    stream->len = 0;
+  }
+  format_event(event, stream->buf + stream->len, EVENT_LINE_LEN);
+  stream->len += strlen(stream->buf + stream->len);
+  stream->buf[stream->len++] = '\n';
+  return true;
+}
+
+static esp_err_t log_get_handler(httpd_req_t* req) {
+  LogStream* stream = malloc(sizeof(LogStream));
+  if (stream == NULL) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    return ESP_FAIL;
+  }
+  stream->req = req;
+  stream->len = 0;
+  httpd_resp_set_type(req, "text/plain");
+  eventlog_read(stream_event, stream);
+  if (stream->len) {
+    httpd_resp_send_chunk(req, stream->buf, stream->len);
+  }
+  httpd_resp_send_chunk(req, NULL, 0);
+  free(stream);
+  return ESP_OK;
+}
+
+static const httpd_uri_t log_uri = {
+    .uri = "/log",
+    .method = HTTP_GET,
+    .handler = log_get_handler,
+};
+
+// Sends flash log sectors straight from mapped flash, no copy
+static bool send_sector(const void* data, size_t length, void* ctx) {
+  return httpd_resp_send_chunk((httpd_req_t*)ctx, data, length) == ESP_OK;
+}
+
+// An optional Unix time from the query string, e.g. ?from=1704067200
+static uint32_t query_time(const char* query, const char* key,
+                           uint32_t missing) {
+  char value[16];
+  if (httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK) {
+    return missing;
+  }
+  return strtoul(value, NULL, 10);
+}
+
+/* Serves the flash log in its on-flash format, oldest sector first. Each
+ * sector starts with a 16 byte header; see flashlog.h for the records.
+ * ?from= and ?to= (Unix time) limit it to the sectors that cover that
+ * range. */
+static esp_err_t history_get_handler(httpd_req_t* req) {
+  char query[EXAMPLE_HTTP_QUERY_KEY_MAX_LEN] = "";
+  httpd_req_get_url_query_str(req, query, sizeof(query));
+  uint32_t from_s = query_time(query, "from", 0);
+  uint32_t to_s = query_time(query, "to", UINT32_MAX);
+  httpd_resp_set_type(req, "application/octet-stream");
+  if (flashlog_stream_range(from_s, to_s, send_sector, req) != ESP_OK) {
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No flash log");
+    return ESP_FAIL;
+  }
+  httpd_resp_send_chunk(req, NULL, 0);
+  return ESP_OK;
+}
+
+static const httpd_uri_t history = {
+    .uri = "/history",
+    .method = HTTP_GET,
+    .handler = history_get_handler,
+};
+
+#define ROLLUP_LINE_LEN 80
+#define ROLLUP_CHUNK_LEN 1024
+
+/* Serves the hourly, or with ?tier=day the daily, rollups as CSV, newest
+ * first. Temperatures in C, local start time. */
+static esp_err_t rollup_get_handler(httpd_req_t* req) {
+  SummaryTier tier = SUMMARY_HOURS;
+  char query[EXAMPLE_HTTP_QUERY_KEY_MAX_LEN];
+  char value[8];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "tier", value, sizeof(value)) == ESP_OK &&
+      strcmp(value, "day") == 0) {
+    tier = SUMMARY_DAYS;
+  }
+
+  char* buf = malloc(ROLLUP_CHUNK_LEN);
+  if (buf == NULL) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    return ESP_FAIL;
+  }
+  httpd_resp_set_type(req, "text/csv");
+  size_t len = snprintf(buf, ROLLUP_CHUNK_LEN,
+                        "start,samples,min_c,mean_c,max_c,relay_on_s\n");
+  RollupRow row;
+  int64_t start_s;
+  for (uint32_t age = 0; summary_get(tier, age, &row, &start_s); age++) {
+    if (len + ROLLUP_LINE_LEN > ROLLUP_CHUNK_LEN) {
+      if (httpd_resp_send_chunk(req, buf, len) != ESP_OK) {
+        free(buf);  // Client went away
+        return ESP_FAIL;
+      }
+      len = 0;
+    }
+    char time_buf[24];
+    time_t t = start_s;
+    struct tm timeinfo;
+    gmtime_r(&t, &timeinfo);  // Already local, see summary_get()
+    strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M", &timeinfo);
+    len += snprintf(buf + len, ROLLUP_LINE_LEN,
+                    "%s,%u,%0.1f,%0.1f,%0.1f,%lu\n", time_buf, row.count,
+                    sample_raw_to_c(row.min_raw),
+                    sample_raw_to_c(rollup_mean_raw(&row)),
+                    sample_raw_to_c(row.max_raw), row.relay_on_s);
+  }
+  httpd_resp_send_chunk(req, buf, len);
+  httpd_resp_send_chunk(req, NULL, 0);
+  free(buf);
+  return ESP_OK;
+}
+
+static const httpd_uri_t rollup = {
+    .uri = "/rollup",
+    .method = HTTP_GET,
+    .handler = rollup_get_handler,
+};
+
+/* Serves the timing histograms as plain text */
+static esp_err_t metrics_get_handler(httpd_req_t* req) {
+  char buf[1024];
+  metrics_format(buf, sizeof(buf));
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_send(req, buf, HTTPD_RESP_USE_STRLEN);
+  return ESP_OK;
+}
+
+static const httpd_uri_t metrics = {
+    .uri = "/metrics",
+    .method = HTTP_GET,
+    .handler = metrics_get_handler,
+};
+
+/* Serves the task and heap profile as plain text */
+static esp_err_t profile_get_handler(httpd_req_t* req) {
+  // The history is a few kB, too much for the stack
+  size_t size = profile_format(NULL, 0) + 1;
+  char* buf = malloc(size);
+  if (buf == NULL) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    return ESP_FAIL;
+  }
+  profile_format(buf, size);
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_send(req, buf, HTTPD_RESP_USE_STRLEN);
+  free(buf);
+  return ESP_OK;
+}
+
+static const httpd_uri_t profile = {
+    .uri = "/profile",
+    .method = HTTP_GET,
+    .handler = profile_get_handler,
+};
+
+/* Serves the control policy and its parameters as a form that posts back
+ * to /policy */
+static esp_err_t policy_get_handler(httpd_req_t* req) {
+  char* buf = malloc(POLICY_PAGE_LEN);
+  if (buf == NULL) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    return ESP_FAIL;
+  }
+  State state = get_state();
+  size_t len = snprintf(buf, POLICY_PAGE_LEN,
+                        "<form method=\"post\" action=\"/policy\">"
+                        "policy <select name=\"policy\">");
+  for (int i = 0; i < POLICY_COUNT; i++) {
+    len += snprintf(buf + len, POLICY_PAGE_LEN - len, "<option%s>%s</option>",
+                    i == state.policy.id ? " selected" : "", policy_name(i));
+  }
+  len += snprintf(buf + len, POLICY_PAGE_LEN - len, "</select></br>");
+  for (int i = 0; i < policy_param_count; i++) {
+    const PolicyParamInfo* info = &policy_param_info[i];
+    len += snprintf(buf + len, POLICY_PAGE_LEN - len,
+                    "%s <input name=\"%s\" value=\"%g\"></br>", info->name,
+                    info->name, policy_param_get(&state.policy.params, info));
+  }
+  snprintf(buf + len, POLICY_PAGE_LEN - len,
+           "<input type=\"submit\" value=\"Set\"></form>"
+           "<a href=\"/\">Home</a>");
+  httpd_resp_set_type(req, "text/html");
+  httpd_resp_send(req, buf, HTTPD_RESP_USE_STRLEN);
+  free(buf);
+  return ESP_OK;
+}
+
+static const httpd_uri_t policy_get = {
+    .uri = "/policy",
+    .method = HTTP_GET,
+    .handler = policy_get_handler,
+};
+
+// A value from a urlencoded form, decoded in place: '+' is a space and %XX
+// a byte. httpd_query_key_value returns it still encoded, so a browser's
+// e.g. "%2D5" would otherwise not parse.
+static esp_err_t form_value(const char* form, const char* key, char* value,
+                            size_t size) {
+  esp_err_t err = httpd_query_key_value(form, key, value, size);
+  if (err != ESP_OK) {
+    return err;
+  }
+  char* out = value;
+  for (const char* in = value; *in != '\0'; in++) {
+    char hex[3] = {0};
+    if (*in == '+') {
+      *out++ = ' ';
+    } else if (*in == '%' && isxdigit((unsigned char)in[1]) &&
+               isxdigit((unsigned char)in[2])) {
+      memcpy(hex, in + 1, 2);
+      *out++ = strtol(hex, NULL, 16);
+      in += 2;
+    } else {
+      *out++ = *in;
+    }
+  }
+  *out = '\0';
+  return ESP_OK;
+}
+
+/* Takes a form body of name=value pairs, e.g. policy=stepped&run_s=90. Any
+ * left out keep their value. Nothing changes if one is not valid, or if
+ * the run would not be shorter than the intervals. */
+static esp_err_t policy_post_handler(httpd_req_t* req) {
+  char form[POLICY_FORM_LEN];
+  if (req->content_len >= sizeof(form)) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Form too long");
+    return ESP_FAIL;
+  }
+  size_t len = 0;
+  while (len < req->content_len) {
+    int received = httpd_req_recv(req, form + len, req->content_len - len);
+    if (received <= 0) {
+      return ESP_FAIL;  // Client went away
+    }
+    len += received;
+  }
+  form[len] = '\0';
+
+  PolicyConfig policy = get_state().policy;
+  char value[24];
+  if (form_value(form, "policy", value, sizeof(value)) == ESP_OK &&
+      !policy_from_name(value, &policy.id)) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown policy");
+    return ESP_FAIL;
+  }
+  for (int i = 0; i < policy_param_count; i++) {
+    const PolicyParamInfo* info = &policy_param_info[i];
+    if (form_value(form, info->name, value, sizeof(value)) == ESP_OK &&
+        !policy_param_set(&policy.params, info, value)) {
+      char message[48];
+      snprintf(message, sizeof(message), "Invalid %s", info->name);
+      httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, message);
+      return ESP_FAIL;
+    }
+  }
+  const char* invalid = policy_invalid(&policy);
+  if (invalid != NULL) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, invalid);
+    return ESP_FAIL;
+  }
+  set_policy(&policy);
+  ESP_LOGI(TAG, "Policy set to %s", policy_name(policy.id));
+  return policy_get_handler(req);
+}
+
+static const httpd_uri_t policy_post = {
+    .uri = "/policy",
+    .method = HTTP_POST,
+    .handler = policy_post_handler,
+};
+
 // TODO: Implement a proper temp override for testing
 static esp_err_t relay_test_handler(httpd_req_t* req) {
-  set_outside_temp_c(-100);
+  set_outside_temp(TEMP16_FROM_C(-100));
+  // Or the control law would follow the trend line instead
+  set_outside_trend(&(TrendEstimate){.cross_s = TREND_NEVER});
 
   return root_get_handler(req);
 }
@@ -94,6 +550,10 @@ static httpd_handle_t start_webserver(void) {
   httpd_handle_t server = NULL;
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
   config.lru_purge_enable = true;
+  config.max_uri_handlers = 10;  // The default 8 is all in use
+  // Handlers run on this stack: the info page builds about 1.5 kB of text
+  // in local buffers and formats floats, more than the default 4 kB allows
+  config.stack_size = 8192;
 
   // Start the httpd server
   ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
@@ -102,6 +562,13 @@ static httpd_handle_t start_webserver(void) {
     ESP_LOGI(TAG, "Registering URI handlers");
     httpd_register_uri_handler(server, &root);
     httpd_register_uri_handler(server, &relay_test);
+    httpd_register_uri_handler(server, &metrics);
+    httpd_register_uri_handler(server, &profile);
+    httpd_register_uri_handler(server, &log_uri);
+    httpd_register_uri_handler(server, &history);
+    httpd_register_uri_handler(server, &rollup);
+    httpd_register_uri_handler(server, &policy_get);
+    httpd_register_uri_handler(server, &policy_post);
     return server;
   }
 
@@ -137,8 +604,6 @@ static void connect_handler(void* arg, esp_event_base_t event_base,
 }
 
 void http_server_task() {
-  time(&boot_time);
-
   static httpd_handle_t server = NULL;
   ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
                                              &connect_handler, &server));
@@ -8,76 +8,77 @@
  */
 
 #include <esp_log.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "boot.h"
+#include "clock.h"
 #include "constants.h"
 #include "driver/gpio.h"
 #include "ds18b20.h"
 #include "esp_netif_sntp.h"
 #include "esp_sntp.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "eventlog.h"
+#include "exposure.h"
+#include "flashlog.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
 #include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "fusion.h"
 #include "httpserver.h"
+#include "metrics.h"
 #include "mdns.h"
 #include "nvs_flash.h"
 #include "owb.h"
 #include "owb_rmt.h"
+#include "persist.h"
+#include "profile.h"
+#include "relay.h"
+#include "snapshot.h"
 #include "state.h"
+#include "state_benchmark.h"
+#include "summary.h"
+#include "trend.h"
 #include "wifi.h"
 
 static const char* TAG = "antifreeze";
 
-void pulse_led(uint32_t led_on_ticks, uint32_t period_ticks) {
+_Static_assert(DS18B20_POOL_SIZE >= TEMP_SENSOR_MAX_PROBES,
+               "A DS18B20 descriptor for every probe");
+
+// The off part of the pulse is cut short if State changes, so the pattern
+// switches at the end of the current flash
+void pulse_led(EventGroupHandle_t events, uint32_t led_on_ticks,
+               uint32_t period_ticks) {
   gpio_set_level(LED_PIN, 1);
   vTaskDelay(led_on_ticks);
   gpio_set_level(LED_PIN, 0);
-  vTaskDelay(period_ticks - led_on_ticks);
+  xEventGroupWaitBits(events, STATE_CHANGED_ALL, pdTRUE, pdFALSE,
+                      period_ticks - led_on_ticks);
 }
 
 void heartbeat_task() {
   gpio_set_direction(LED_PIN, GPIO_MODE_OUTPUT);
+  EventGroupHandle_t events = xEventGroupCreate();
+  ESP_ERROR_CHECK(state_subscribe(events, STATE_CHANGED_ALL));
   while (true) {
-    // The lag in switching state indication is acceptable
-    if (get_relay_activated()) {
-      pulse_led(RELAY_ACTIVATED_LED_ON_TICKS, RELAY_ACTIVATED_HEARTBEAT_TICKS);
-    } else if (freeze_danger_present()) {
-      pulse_led(LED_ON_TICKS, FREEZE_DANGER_HEARTBEAT_TICKS);
+    State state = get_state();
+    if (state.relay_on) {
+      pulse_led(events, RELAY_ACTIVATED_LED_ON_TICKS,
+                RELAY_ACTIVATED_HEARTBEAT_TICKS);
+    } else if (freeze_danger_present(&state)) {
+      pulse_led(events, LED_ON_TICKS, FREEZE_DANGER_HEARTBEAT_TICKS);
     } else {
-      pulse_led(LED_ON_TICKS, NORMAL_HEARTBEAT_TICKS);
+      pulse_led(events, LED_ON_TICKS, NORMAL_HEARTBEAT_TICKS);
     }
   }
 }
 
-time_t get_next_relay_activation_time_s() {
-  float outside_temp_c = get_outside_temp_c();
-  float freeze_danger_temp_c = get_freeze_danger_temp_c();
-
-  if (outside_temp_c > freeze_danger_temp_c) {
-    return THE_END_OF_TIME;
-  }
-
-  float delta_t = freeze_danger_temp_c - outside_temp_c;
-  time_t relay_last_activated_s = get_relay_activated_time_s();
-  return relay_last_activated_s +
-         MAX_CIRC_INTERVAL_S / (1 + RELAY_PERIOD_SCALING_CONSTANT * delta_t);
-}
-
-void relay_activate_task() {
-  gpio_set_direction(RELAY_PIN, GPIO_MODE_OUTPUT);
-  time_t now_s;
-  while (true) {
-    time_t next_relay_activation_time_s = get_next_relay_activation_time_s();
-    time(&now_s);
-    if (now_s < next_relay_activation_time_s) {
-      vTaskDelay(RELAY_TASK_INTERVAL_TICKS);
-      continue;
-    }
-    gpio_set_level(RELAY_PIN, 1);
-    set_relay_activated(now_s);
-    vTaskDelay(CIRC_ON_TICKS);
-    gpio_set_level(RELAY_PIN, 0);
-    set_relay_deactivated();
-  }
+static void sample_timer_callback(void* arg) {
+  xTaskNotifyGive((TaskHandle_t)arg);
 }
 
 // TODO: Clean up this function
@@ -90,37 +91,172 @@ void temperature_sample_task(void* pvParameter) {
   // Stable readings require a brief period before communication
   vTaskDelay(2000.0 / portTICK_PERIOD_MS);
 
-  owb_rmt_driver_info rmt_driver_info;
-  owb = owb_rmt_initialize(&rmt_driver_info, TEMP_SENSOR_PIN, RMT_CHANNEL_1,
+  // Driver and device descriptors come from static pools rather than the
+  // heap
+  owb_rmt_driver_info* rmt_driver_info = owb_rmt_pool_alloc();
+  if (rmt_driver_info == NULL) {
+    ESP_LOGE(TAG, "No 1-Wire driver left in the pool, not sampling");
+    vTaskDelete(NULL);
+  }
+  owb = owb_rmt_initialize(rmt_driver_info, TEMP_SENSOR_PIN, RMT_CHANNEL_1,
                            RMT_CHANNEL_0);
   owb_use_crc(owb, true);  // enable CRC check for ROM code
 
-  OneWireBus_SearchState search_state = {0};
-  bool found = false;
-  while (!found) {
-    ESP_LOGI(TAG, "Looking for DS18B20 outdoor temp probe.");
+  // Up to TEMP_SENSOR_MAX_PROBES redundant outdoor probes share the bus
+  OneWireBus_ROMCode rom_codes[TEMP_SENSOR_MAX_PROBES];
+  int probe_count = 0;
+  while (probe_count == 0) {
+    ESP_LOGI(TAG, "Looking for DS18B20 outdoor temp probes.");
+    OneWireBus_SearchState search_state = {0};
+    bool found = false;
     owb_search_first(owb, &search_state, &found);
-    vTaskDelay(TEMP_SAMPLE_PERIOD_TICKS);
+    while (found && probe_count < TEMP_SENSOR_MAX_PROBES) {
+      rom_codes[probe_count++] = search_state.rom_code;
+      owb_search_next(owb, &search_state, &found);
+    }
+    if (probe_count == 0) {
+      vTaskDelay(TEMP_SAMPLE_PERIOD_TICKS);
+    }
   }
 
-  char rom_code_s[OWB_ROM_CODE_STRING_LENGTH];
-  owb_string_from_rom_code(search_state.rom_code, rom_code_s,
-                           sizeof(rom_code_s));
-  ESP_LOGI(TAG, "Probe found. ROM Code:  %s\n", rom_code_s);
+  // Only touches the scratchpad (and EEPROM) if the probe is not already
+  // configured this way, which is the case on every boot after the first
+  DS18B20_Config ds18b20_config = {
+      .resolution = TEMP_SENSOR_RESOLUTION,
+      .trigger_high = TEMP_SENSOR_ALARM_HIGH_C,
+      .trigger_low = TEMP_SENSOR_ALARM_LOW_C,
+  };
 
-  // Create DS18B20 device on the 1-Wire bus
-  DS18B20_Info* ds18b20_info = ds18b20_malloc();  // heap allocation
-  ds18b20_init_solo(ds18b20_info, owb);           // only one device on bus
-  ds18b20_use_crc(ds18b20_info, true);  // enable CRC check on all reads
-  ds18b20_set_resolution(ds18b20_info,
-                         DS18B20_RESOLUTION_12_BIT);  // The counterfeit ones
-                                                      // make trouble with 9bit
+  DS18B20_Info* ds18b20_infos[TEMP_SENSOR_MAX_PROBES];
+  Probe probes[TEMP_SENSOR_MAX_PROBES];
+  int found_count = probe_count;
+  probe_count = 0;
+  for (int f = 0; f < found_count; f++) {
+    char rom_code_s[OWB_ROM_CODE_STRING_LENGTH];
+    owb_string_from_rom_code(rom_codes[f], rom_code_s, sizeof(rom_code_s));
+    ESP_LOGI(TAG, "Probe found. ROM Code:  %s\n", rom_code_s);
 
-  float t_c = 0;
+    // Create DS18B20 device on the 1-Wire bus
+    DS18B20_Info* info = ds18b20_pool_alloc();
+    if (info == NULL) {
+      ESP_LOGE(TAG, "No DS18B20 descriptor left in the pool, skipping %s",
+               rom_code_s);
+      continue;
+    }
+    int i = probe_count++;
+    rom_codes[i] = rom_codes[f];
+    ds18b20_infos[i] = info;
+    if (found_count == 1) {
+      ds18b20_init_solo(ds18b20_infos[i], owb);  // only one device on bus
+    } else {
+      ds18b20_init(ds18b20_infos[i], owb, rom_codes[i]);
+    }
+    ds18b20_use_crc(ds18b20_infos[i], true);  // enable CRC check on all reads
+    if (!ds18b20_configure(ds18b20_infos[i], &ds18b20_config,
+                           /* persist */ true)) {
+      ESP_LOGW(TAG, "Could not configure DS18B20 probe %s.", rom_code_s);
+    }
+    // After a soft reset the probe keeps its recent samples and health
+    if (!snapshot_restore_probe(&probes[i], rom_codes[i].bytes)) {
+      probe_init(&probes[i], rom_codes[i].bytes);
+    }
+  }
+  if (probe_count == 0) {
+    ESP_LOGE(TAG, "No probe could be set up, not sampling");
+    vTaskDelete(NULL);
+  }
+
+  // Samples are paced by a periodic esp_timer, not by a delay after the
+  // conversion, so the conversion time does not accumulate as drift. The
+  // first sample is taken straight away.
+  SampleJitter jitter = {0};
+  static Trend trend;  // Too big for the stack
+  trend_init(&trend);
+  // Carries on from a snapshot after a soft reset
+  Exposure exposure;
+  exposure_init(&exposure, get_state().freeze_exposure);
+  int32_t logged_exposure = 0;
+  esp_timer_handle_t sample_timer;
+  esp_timer_create_args_t sample_timer_args = {
+      .callback = sample_timer_callback,
+      .arg = xTaskGetCurrentTaskHandle(),
+      .name = "sample",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&sample_timer_args, &sample_timer));
+  int64_t sample_grid_start_us = esp_timer_get_time();
+  ESP_ERROR_CHECK(
+      esp_timer_start_periodic(sample_timer, TEMP_SAMPLE_PERIOD_US));
+  xTaskNotifyGive(xTaskGetCurrentTaskHandle());
+
+  Sample sample = {0};
   while (true) {
-    DS18B20_ERROR err = ds18b20_convert_and_read_temp(ds18b20_info, &t_c);
-    set_outside_temp_c(t_c);
-    vTaskDelay(TEMP_SAMPLE_PERIOD_TICKS);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    int64_t sample_start_us = metric_start();
+    sample.timestamp_us = esp_timer_get_time();
+    // Nearest slot on the grid, skipping any that a slow sample overran
+    int64_t slot = (sample.timestamp_us - sample_grid_start_us +
+                    TEMP_SAMPLE_PERIOD_US / 2) /
+                   TEMP_SAMPLE_PERIOD_US;
+    sample.scheduled_us = sample_grid_start_us + slot * TEMP_SAMPLE_PERIOD_US;
+    sample_jitter_update(&jitter, &sample, TEMP_SAMPLE_PERIOD_US);
+    set_sample_jitter(&jitter);
+
+    // All probes convert together, then each is read by ROM code. Only
+    // readings that survive each probe's pipeline take part in the vote.
+    ds18b20_convert_all(owb);
+    int64_t wait_start_us = metric_start();
+    ds18b20_wait_for_conversion(ds18b20_infos[0]);
+    metric_end(METRIC_CONVERT_WAIT, wait_start_us);
+    for (int i = 0; i < probe_count; i++) {
+      memcpy(sample.rom_code, rom_codes[i].bytes, sizeof(sample.rom_code));
+      int64_t read_start_us = metric_start();
+      sample.err = ds18b20_read_temp_raw(ds18b20_infos[i], &sample.raw);
+      metric_end(METRIC_SCRATCHPAD_READ, read_start_us);
+      SampleStatus status = probe_push(&probes[i], &sample);
+      if (status != SAMPLE_OK) {
+        ESP_LOGW(TAG, "Rejected sample from probe %d: status %d, raw %d, "
+                 "error %d", i, status, sample.raw, sample.err);
+      }
+    }
+
+    // A failed or outvoted read leaves the last good value in place for
+    // the control law. Only a new reading is logged and fitted, so a run
+    // of failed reads does not repeat it.
+    FusedTemp fused = fuse_probes(probes, probe_count, esp_timer_get_time());
+    if (fused.valid) {
+      // Marked first, so the decision this wakes counts as the first
+      boot_mark(BOOT_FIRST_SAMPLE);
+      set_outside_temp(fused.raw);
+    }
+    if (fused.fresh) {
+      eventlog_append(EVENT_TEMPERATURE, fused.raw);
+      summary_add_sample(clock_now_us(), fused.raw);
+
+      int64_t now_s = clock_now_us() / 1000000LL;
+      State state = get_state();
+      Temp16 threshold = state.freeze_danger_temp;
+      trend_add(&trend, now_s, fused.raw);
+      TrendEstimate estimate = trend_estimate(&trend, now_s, threshold);
+      set_outside_trend(&estimate);
+
+      exposure_add(&exposure, now_s, fused.raw, threshold,
+                   state.policy.params.exposure_decay_s);
+      int32_t deg_min = exposure_get(&exposure) / EXPOSURE_PER_DEG_MIN;
+      set_freeze_exposure(exposure_get(&exposure));
+      if (abs(deg_min - logged_exposure) >= EXPOSURE_LOG_STEP_DEG_MIN ||
+          (deg_min == 0 && logged_exposure != 0)) {
+        eventlog_append(EVENT_EXPOSURE,
+                        deg_min < INT16_MAX ? deg_min : INT16_MAX);
+        logged_exposure = deg_min;
+      }
+    }
+    set_outside_temp_stale(!fused.valid);
+    set_probe_health(probes, probe_count);
+    metric_end(METRIC_SAMPLE, sample_start_us);
+
+    snapshot_save_probes(probes, probe_count);
+    State state = get_state();
+    snapshot_save_state(&state);
   }
 }
 
@@ -135,16 +271,24 @@ void init_flash() {
   ESP_ERROR_CHECK(ret);
 }
 
-void init_time() {
+static void on_time_sync(struct timeval* tv) {
+  clock_on_sync(tv);
+  persist_on_time_valid();
+}
+
+bool init_time() {
   esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG(NTP_SERVER);
+  // Slew rather than step small corrections. Scheduling does not use the
+  // wall clock, so this is only for display, but it keeps logs monotonic.
+  config.smooth_sync = true;
+  config.sync_cb = on_time_sync;
   esp_netif_sntp_init(&config);
-  if (esp_netif_sntp_sync_wait(pdMS_TO_TICKS(10000)) != ESP_OK) {
+  bool synced = esp_netif_sntp_sync_wait(pdMS_TO_TICKS(10000)) == ESP_OK;
+  if (!synced) {
     ESP_LOGE(TAG, "Failed to update system time within 10s timeout");
   } else {
     ESP_LOGI(TAG, "Obtained time from " NTP_SERVER);
   }
-  setenv("TZ", TIME_ZONE, 1);
-  tzset();
 
   time_t now;
   char strftime_buf[64];
@@ -154,6 +298,7 @@ void init_time() {
   localtime_r(&now, &timeinfo);
   strftime(strftime_buf, sizeof(strftime_buf), "%c", &timeinfo);
   ESP_LOGI(TAG, "Antifreeze thinks the time is: %s\n", strftime_buf);
+  return synced;
 }
 
 void start_mdns_service() {
@@ -171,34 +316,86 @@ void start_mdns_service() {
   mdns_service_add(NULL, MDNS_SERVICENAME, "_tcp", 80, NULL, 0);
 }
 
-void app_main() {
-  init_flash();
-  wifi_init_sta();
-  init_time();
+// Brings up WiFi, time and mDNS, none of which freeze protection needs,
+// then hands over to the HTTP server. Each step may block for a while.
+void network_task() {
+  if (wifi_init_sta()) {
+    boot_mark(BOOT_WIFI_CONNECTED);
+  }
+  if (init_time()) {
+    boot_mark(BOOT_TIME_SYNCED);
+  }
   start_mdns_service();
 
+  TaskHandle_t http_server_task_h;
+  xTaskCreate(http_server_task, "HTTP server", 4096, NULL, tskIDLE_PRIORITY,
+              &http_server_task_h);
+  boot_mark(BOOT_NETWORK_READY);
+  vTaskDelete(NULL);
+}
+
+void app_main() {
+  boot_start_budget_check();
+  // Only local work before the control tasks start: NVS and RTC memory
+  init_flash();
   // TODO: error check inside the function
   ESP_ERROR_CHECK(initialize_state());
+  ESP_ERROR_CHECK(persist_restore());
+  snapshot_restore();
+  boot_mark(BOOT_STATE_RESTORED);
+  eventlog_append(EVENT_BOOT, esp_reset_reason());
+  flashlog_init();
+  // Before the first sample: rollups are cut on local days
+  setenv("TZ", TIME_ZONE, 1);
+  tzset();
+  summary_init();
+#if CONFIG_STATE_BENCHMARK
+  run_state_benchmark();
+#endif
+#if CONFIG_RELAY_PULSE_CHECK
+  run_relay_pulse_check();
+#endif
 
   TaskHandle_t heartbeat_task_h;
-  TaskHandle_t relay_activate_task_h;
+  TaskHandle_t relay_scheduler_task_h;
   TaskHandle_t temperature_sample_task_h;
-  TaskHandle_t http_server_task_h;
+  TaskHandle_t persist_task_h;
+  TaskHandle_t network_task_h;
+  TaskHandle_t profile_task_h;
+  TaskHandle_t flashlog_task_h;
+  TaskHandle_t summary_rebuild_task_h;
 
   xTaskCreate(heartbeat_task, "Heartbeat", 1024, NULL, tskIDLE_PRIORITY,
               &heartbeat_task_h);
-  xTaskCreate(relay_activate_task, "Relay Activate", 1024, NULL,
-              tskIDLE_PRIORITY, &relay_activate_task_h);
+  xTaskCreate(relay_scheduler_task, "Relay Scheduler", 2048, NULL,
+              tskIDLE_PRIORITY, &relay_scheduler_task_h);
   xTaskCreate(temperature_sample_task, "Temp Sample", 4096, NULL,
               tskIDLE_PRIORITY, &temperature_sample_task_h);
-  xTaskCreate(http_server_task, "HTTP server", 4096, NULL, tskIDLE_PRIORITY,
-              &http_server_task_h);
+  xTaskCreate(persist_task, "Persist", 3072, NULL, tskIDLE_PRIORITY,
+              &persist_task_h);
+  boot_mark(BOOT_CONTROL_STARTED);
+
+  // Freeze protection is already running; the network comes up alongside
+  xTaskCreate(network_task, "Network", 4096, NULL, tskIDLE_PRIORITY,
+              &network_task_h);
+  xTaskCreate(profile_task, "Profile", 2048, NULL, tskIDLE_PRIORITY,
+              &profile_task_h);
+  xTaskCreate(flashlog_task, "Flash log", 3072, NULL, tskIDLE_PRIORITY,
+              &flashlog_task_h);
+  xTaskCreate(summary_rebuild_task, "Summary rebuild", 3072, NULL,
+              tskIDLE_PRIORITY, &summary_rebuild_task_h);
 
   while (true) {
     State state = get_state();
-    ESP_LOGI(TAG, "Temperature: %0.1f", state.outside_temp_c);
-    ESP_LOGI(TAG, "Relay activated %llds ago",
-             get_relay_activated_elapsed_time_s());
+    ESP_LOGI(TAG, "Temperature: %0.1f",
+             sample_raw_to_c(state.outside_temp));
+    if (state.relay_activated_us != CLOCK_NEVER_US) {
+      ESP_LOGI(TAG, "Relay activated %llds ago",
+               (clock_now_us() - state.relay_activated_us) / 1000000LL);
+    }
+    ESP_LOGI(TAG, "Probes in pool: %u, free heap: %lu (min %lu)",
+             (unsigned)ds18b20_pool_in_use(), esp_get_free_heap_size(),
+             esp_get_minimum_free_heap_size());
     vTaskDelay(5 * configTICK_RATE_HZ);
   }
 }
@@ -0,0 +1,170 @@
+#include "metrics.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "boot.h"
+#include "clock.h"
+
+// Log-linear buckets: each power of two is split into 4, so a bucket is at
+// most 25% wide. Values below 4 us get a bucket each. Anything from 2^24 us
+// (about 17 s) up lands in an overflow bucket of its own, after the ones
+// for msb METRIC_MAX_MSB.
+#define METRIC_SUB_BITS 2
+#define METRIC_SUB_BUCKETS (1 << METRIC_SUB_BITS)
+#define METRIC_MAX_MSB 23
+#define METRIC_OVERFLOW_BUCKET \
+  ((METRIC_MAX_MSB - METRIC_SUB_BITS + 2) * METRIC_SUB_BUCKETS)
+#define METRIC_BUCKETS (METRIC_OVERFLOW_BUCKET + 1)
+
+// Only 32 bit atomics, which are lock free on the ESP32. The sum is split
+// across two words and carried by hand, so a reader may see it torn for an
+// instant; that only nudges the mean.
+typedef struct {
+  atomic_uint count;
+  atomic_uint sum_lo;
+  atomic_uint sum_hi;
+  atomic_uint min_inverted_us;  // UINT32_MAX - min, so zero means none yet
+  atomic_uint max_us;
+  atomic_uint buckets[METRIC_BUCKETS];
+} Histogram;
+
+static Histogram histograms[METRIC_COUNT];
+
+static const char* metric_names[METRIC_COUNT] = {
+    [METRIC_SAMPLE] = "sample",
+    [METRIC_CONVERT_WAIT] = "convert_wait",
+    [METRIC_SCRATCHPAD_READ] = "scratchpad_read",
+    [METRIC_RELAY_DECISION] = "relay_decision",
+    [METRIC_HTTP_RENDER] = "http_render",
+};
+
+static int bucket_of(uint32_t us) {
+  if (us < METRIC_SUB_BUCKETS) {
+    return us;
+  }
+  int msb = 31 - __builtin_clz(us);
+  if (msb > METRIC_MAX_MSB) {
+    return METRIC_OVERFLOW_BUCKET;
+  }
+  int sub = (us >> (msb - METRIC_SUB_BITS)) & (METRIC_SUB_BUCKETS - 1);
+  return (msb - METRIC_SUB_BITS + 1) * METRIC_SUB_BUCKETS + sub;
+}
+
+// Largest value that lands in the bucket. The overflow bucket is open ended.
+static uint32_t bucket_upper_us(int bucket) {
+  if (bucket == METRIC_OVERFLOW_BUCKET) {
+    return UINT32_MAX;
+  }
+  if (bucket < METRIC_SUB_BUCKETS) {
+    return bucket;
+  }
+  int msb = bucket / METRIC_SUB_BUCKETS + METRIC_SUB_BITS - 1;
+  int sub = bucket % METRIC_SUB_BUCKETS;
+  uint32_t width = 1u << (msb - METRIC_SUB_BITS);
+  return ((uint32_t)(METRIC_SUB_BUCKETS + sub) << (msb - METRIC_SUB_BITS)) +
+         width - 1;
+}
+
+int64_t metric_start() { return clock_now_us(); }
+
+void metric_end(MetricId id, int64_t start_us) {
+  int64_t us = clock_now_us() - start_us;
+  metric_record(id, us > UINT32_MAX ? UINT32_MAX : (uint32_t)us);
+}
+
+void metric_record(MetricId id, uint32_t us) {
+  Histogram* h = &histograms[id];
+  atomic_fetch_add_explicit(&h->buckets[bucket_of(us)], 1,
+                            memory_order_relaxed);
+  unsigned lo = atomic_fetch_add_explicit(&h->sum_lo, us, memory_order_relaxed);
+  if (lo > UINT32_MAX - us) {
+    atomic_fetch_add_explicit(&h->sum_hi, 1, memory_order_relaxed);
+  }
+
+  // Count is bumped last so a reader never sees a count without a min
+  unsigned min_inverted = UINT32_MAX - us;
+  unsigned old = atomic_load_explicit(&h->min_inverted_us, memory_order_relaxed);
+  while (min_inverted > old &&
+         !atomic_compare_exchange_weak_explicit(&h->min_inverted_us, &old,
+                                                min_inverted,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+  }
+  unsigned max = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+  while (us > max &&
+         !atomic_compare_exchange_weak_explicit(&h->max_us, &max, us,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+  }
+  atomic_fetch_add_explicit(&h->count, 1, memory_order_release);
+}
+
+MetricSummary metric_summary(MetricId id) {
+  Histogram* h = &histograms[id];
+  MetricSummary s = {0};
+  s.count = atomic_load_explicit(&h->count, memory_order_acquire);
+  if (s.count == 0) {
+    return s;
+  }
+  uint64_t sum = ((uint64_t)atomic_load(&h->sum_hi) << 32) |
+                 atomic_load(&h->sum_lo);
+  s.mean_us = sum / s.count;
+  s.min_us = UINT32_MAX - atomic_load(&h->min_inverted_us);
+  s.max_us = atomic_load(&h->max_us);
+
+  // Bucket counts may run slightly ahead of count, which is fine for a
+  // percentile
+  uint32_t total = 0;
+  uint32_t counts[METRIC_BUCKETS];
+  for (int i = 0; i < METRIC_BUCKETS; i++) {
+    counts[i] = atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+    total += counts[i];
+  }
+  uint32_t p50_rank = (total + 1) / 2;
+  uint32_t p99_rank = total - total / 100;
+  uint32_t seen = 0;
+  for (int i = 0; i < METRIC_BUCKETS; i++) {
+    uint32_t before = seen;
+    seen += counts[i];
+    if (before < p50_rank && seen >= p50_rank) {
+      s.p50_us = bucket_upper_us(i);
+    }
+    if (before < p99_rank && seen >= p99_rank) {
+      s.p99_us = bucket_upper_us(i);
+      break;
+    }
+  }
+  // The bucket bound can overshoot what was actually seen
+  if (s.p50_us > s.max_us) {
+    s.p50_us = s.max_us;
+  }
+  if (s.p99_us > s.max_us) {
+    s.p99_us = s.max_us;
+  }
+  return s;
+}
+
+const char* metric_name(MetricId id) { return metric_names[id]; }
+
+// Once truncated, only count the length: buf + len may be past the end
+#define APPEND(...)                                          \
+  len += snprintf(len < size ? buf + len : NULL,             \
+                  len < size ? size - len : 0, __VA_ARGS__)
+
+size_t metrics_format(char* buf, size_t size) {
+  size_t len = 0;
+  for (int i = 0; i < METRIC_COUNT; i++) {
+    MetricSummary s = metric_summary(i);
+    APPEND("%s count=%lu min_us=%lu mean_us=%lu p50_us=%lu p99_us=%lu "
+           "max_us=%lu\n",
+           metric_name(i), (unsigned long)s.count, (unsigned long)s.min_us,
+           (unsigned long)s.mean_us, (unsigned long)s.p50_us,
+           (unsigned long)s.p99_us, (unsigned long)s.max_us);
+  }
+  for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+    APPEND("boot \"%s\" us=%lld\n", boot_phase_name(i),
+           (long long)boot_phase_us(i));
+  }
+  return len;
+}
@@ -0,0 +1,48 @@
+/*
+ * Timing spans on the hot paths, each kept in a fixed-size histogram that
+ * is updated with atomics only, so it is cheap enough to leave on.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+  METRIC_SAMPLE = 0,          // A whole sampling cycle, all probes
+  METRIC_CONVERT_WAIT,        // Waiting for the DS18B20 conversion
+  METRIC_SCRATCHPAD_READ,     // Reading one probe's temperature
+  METRIC_RELAY_DECISION,      // Rescheduling the relay after a change
+  METRIC_HTTP_RENDER,         // Building the status page
+  METRIC_COUNT,
+} MetricId;
+
+typedef struct {
+  uint32_t count;
+  uint32_t min_us;
+  uint32_t mean_us;
+  uint32_t max_us;
+  // From the histogram, so an upper bound within 25%
+  uint32_t p50_us;
+  uint32_t p99_us;
+} MetricSummary;
+
+// Usage: int64_t t = metric_start(); ...; metric_end(METRIC_SAMPLE, t);
+int64_t metric_start();
+void metric_end(MetricId, int64_t start_us);
+void metric_record(MetricId, uint32_t us);
+
+MetricSummary metric_summary(MetricId);
+const char* metric_name(MetricId);
+
+// Plain text, one line per span and one per boot phase. Returns the length
+// written, as snprintf.
+size_t metrics_format(char* buf, size_t size);
+
+#endif  // _METRICS_H_
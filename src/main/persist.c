@@ -0,0 +1,294 @@
+#include "persist.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include "clock.h"
+#include "constants.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "nvs.h"
+#include "snapshot.h"
+#include "state.h"
+
+static const char* TAG = "persist";
+
+// Bump when a record layout changes; older records are then ignored
+#define PERSIST_VERSION 3
+
+typedef struct {
+  uint32_t version;
+  Temp16 freeze_danger_temp;
+  int16_t reserved;  // Keeps the padding zero, records are compared whole
+  PolicyConfig policy;
+} ConfigRecord;
+
+// Monotonic time does not survive a reboot, so the activation is saved as
+// wall-clock time
+typedef struct {
+  uint32_t version;
+  int64_t relay_activated_time_s;  // 0 if the clock was not set
+} RelayRecord;
+
+// Each class of change has its own record, so a relay activation does not
+// rewrite the configuration and vice versa
+typedef struct {
+  const char* key;
+  EventBits_t bits;
+  int64_t min_interval_us;
+  bool dirty;
+  bool written;  // Anything written since boot
+  int64_t last_write_us;
+} PersistClass;
+
+static PersistClass config_class = {
+    .key = "config",
+    .bits = STATE_CHANGED_THRESHOLD,
+    .min_interval_us = PERSIST_CONFIG_MIN_INTERVAL_US,
+};
+static PersistClass relay_class = {
+    .key = "relay",
+    .bits = STATE_CHANGED_RELAY,
+    .min_interval_us = PERSIST_RELAY_MIN_INTERVAL_US,
+};
+
+// What is in flash right now, so unchanged values are never rewritten
+static ConfigRecord saved_config;
+static RelayRecord saved_relay;
+
+// A saved activation time waiting for the clock, and the activation used
+// until then. It is only put in place if that is still the last one.
+static atomic_bool saved_time_pending;
+static int64_t provisional_activated_us = CLOCK_NEVER_US;
+
+static esp_err_t read_record(nvs_handle_t nvs, const char* key, void* record,
+                             size_t size) {
+  size_t length = size;
+  esp_err_t err = nvs_get_blob(nvs, key, record, &length);
+  if (err != ESP_OK) {
+    return err;
+  }
+  if (length != size || *(uint32_t*)record != PERSIST_VERSION) {
+    return ESP_ERR_INVALID_VERSION;
+  }
+  return ESP_OK;
+}
+
+// Resets that can repeat and so fire the relay on every boot. A power cut
+// is not one of them.
+static bool reboot_loop_reset() {
+  switch (esp_reset_reason()) {
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+    case ESP_RST_BROWNOUT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+esp_err_t persist_restore() {
+  nvs_handle_t nvs;
+  esp_err_t err = nvs_open(PERSIST_NAMESPACE, NVS_READONLY, &nvs);
+  if (err != ESP_OK) {
+    // Nothing has been saved yet
+    ESP_LOGI(TAG, "No saved state: %s", esp_err_to_name(err));
+    return ESP_OK;
+  }
+
+  if (read_record(nvs, config_class.key, &saved_config,
+                  sizeof(saved_config)) == ESP_OK) {
+    ESP_LOGI(TAG, "Restored freeze danger temp %0.1f C",
+             sample_raw_to_c(saved_config.freeze_danger_temp));
+    set_freeze_danger_temp(saved_config.freeze_danger_temp);
+    const char* invalid = policy_invalid(&saved_config.policy);
+    if (invalid == NULL) {
+      ESP_LOGI(TAG, "Restored %s policy",
+               policy_name(saved_config.policy.id));
+      set_policy(&saved_config.policy);
+    } else {
+      ESP_LOGW(TAG, "Saved policy not valid (%s), using defaults", invalid);
+    }
+  } else {
+    saved_config = (ConfigRecord){0};
+  }
+
+  if (read_record(nvs, relay_class.key, &saved_relay, sizeof(saved_relay)) ==
+      ESP_OK) {
+    // Without the clock the saved time cannot be placed. After a crash,
+    // watchdog or brownout the activation is taken as just now: better late
+    // than a burst of activations from a reboot loop. After a power cut the
+    // pipes may already be cold, so the policy decides afresh. Either way
+    // persist_on_time_valid() puts the saved time back once SNTP answers.
+    // A saved time ahead of the clock is taken as now.
+    int64_t now_us = clock_now_us();
+    if (saved_relay.relay_activated_time_s != 0 && clock_wall_valid()) {
+      int64_t activated_us =
+          clock_from_wall_s(saved_relay.relay_activated_time_s);
+      if (activated_us > now_us) {
+        activated_us = now_us;
+      }
+      ESP_LOGI(TAG, "Restored relay activation %llds ago",
+               (now_us - activated_us) / 1000000LL);
+      set_relay_activated_us(activated_us);
+    } else {
+      atomic_store(&saved_time_pending,
+                   saved_relay.relay_activated_time_s != 0);
+      if (reboot_loop_reset()) {
+        ESP_LOGW(TAG, "Relay activation time unknown, using now");
+        provisional_activated_us = now_us;
+        set_relay_activated_us(now_us);
+      } else {
+        ESP_LOGW(TAG, "Relay activation time unknown, deciding afresh");
+      }
+    }
+  } else {
+    saved_relay = (RelayRecord){0};
+  }
+
+  nvs_close(nvs);
+  return ESP_OK;
+}
+
+void persist_on_time_valid() {
+  if (!atomic_exchange(&saved_time_pending, false) ||
+      get_state().relay_activated_us != provisional_activated_us) {
+    return;  // Nothing waiting, or the relay has run since
+  }
+  int64_t now_us = clock_now_us();
+  int64_t activated_us = clock_from_wall_s(saved_relay.relay_activated_time_s);
+  if (activated_us > now_us) {
+    activated_us = now_us;
+  }
+  ESP_LOGI(TAG, "Restored relay activation %llds ago, now the clock is set",
+           (now_us - activated_us) / 1000000LL);
+  set_relay_activated_us(activated_us);
+}
+
+static bool write_record(const char* key, const void* record, size_t size) {
+  nvs_handle_t nvs;
+  esp_err_t err = nvs_open(PERSIST_NAMESPACE, NVS_READWRITE, &nvs);
+  if (err == ESP_OK) {
+    err = nvs_set_blob(nvs, key, record, size);
+    if (err == ESP_OK) {
+      err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to save %s: %s", key, esp_err_to_name(err));
+    return false;
+  }
+  ESP_LOGI(TAG, "Saved %s", key);
+  return true;
+}
+
+// Fills in the record for a class from State. Returns false if it matches
+// what is already in flash.
+static bool changed_record(const PersistClass* c, const State* state,
+                           void* record) {
+  if (c == &config_class) {
+    ConfigRecord* r = record;
+    *r = (ConfigRecord){
+        .version = PERSIST_VERSION,
+        .freeze_danger_temp = state->freeze_danger_temp,
+        .policy = state->policy,
+    };
+    return memcmp(r, &saved_config, sizeof(*r)) != 0;
+  }
+  RelayRecord* r = record;
+  if (state->relay_activated_us == CLOCK_NEVER_US) {
+    return false;  // Nothing new since boot
+  }
+  *r = (RelayRecord){
+      .version = PERSIST_VERSION,
+      .relay_activated_time_s = clock_to_wall_s(state->relay_activated_us),
+  };
+  return memcmp(r, &saved_relay, sizeof(*r)) != 0;
+}
+
+// Writes the class's record if it is dirty and its interval has passed.
+// Returns how long until it may be written, or -1 if nothing is pending.
+static int64_t flush(PersistClass* c, const State* state, int64_t now_us) {
+  if (!c->dirty) {
+    return -1;
+  }
+  if (c == &relay_class && !clock_wall_valid()) {
+    // Without the clock the time cannot be saved, and writing 0 would lose
+    // a good saved one. Written once the clock is set.
+    return c->min_interval_us;
+  }
+  union {
+    ConfigRecord config;
+    RelayRecord relay;
+  } record;
+  if (!changed_record(c, state, &record)) {
+    // e.g. the relay switching off, which does not change the history
+    c->dirty = false;
+    return -1;
+  }
+  int64_t wait_us =
+      c->written ? c->last_write_us + c->min_interval_us - now_us : 0;
+  if (wait_us > 0) {
+    return wait_us;
+  }
+
+  size_t size = c == &config_class ? sizeof(record.config)
+                                   : sizeof(record.relay);
+  c->written = true;
+  c->last_write_us = now_us;
+  if (!write_record(c->key, &record, size)) {
+    // Retried after the interval rather than straight away
+    return c->min_interval_us;
+  }
+  if (c == &config_class) {
+    saved_config = record.config;
+  } else {
+    saved_relay = record.relay;
+  }
+  c->dirty = false;
+  return -1;
+}
+
+void persist_task() {
+  EventGroupHandle_t events = xEventGroupCreate();
+  PersistClass* classes[] = {&config_class, &relay_class};
+  const int class_count = sizeof(classes) / sizeof(classes[0]);
+  EventBits_t mask = 0;
+  for (int i = 0; i < class_count; i++) {
+    mask |= classes[i]->bits;
+  }
+  ESP_ERROR_CHECK(state_subscribe(events, mask));
+
+  TickType_t wait_ticks = portMAX_DELAY;
+  while (true) {
+    EventBits_t bits =
+        xEventGroupWaitBits(events, mask, pdTRUE, pdFALSE, wait_ticks);
+
+    // Every change in a class before its deadline goes out in one write
+    State state = get_state();
+    if (bits & mask) {
+      snapshot_save_state(&state);
+    }
+    int64_t now_us = esp_timer_get_time();
+    int64_t next_us = -1;
+    for (int i = 0; i < class_count; i++) {
+      PersistClass* c = classes[i];
+      if (bits & c->bits) {
+        c->dirty = true;
+      }
+      int64_t wait_us = flush(c, &state, now_us);
+      if (wait_us >= 0 && (next_us < 0 || wait_us < next_us)) {
+        next_us = wait_us;
+      }
+    }
+    wait_ticks = next_us < 0 ? portMAX_DELAY
+                             : pdMS_TO_TICKS(next_us / 1000) + 1;
+  }
+}
@@ -0,0 +1,31 @@
+/*
+ * Keeps configuration and relay history in NVS so they survive a reboot.
+ * Writes are coalesced per class of change to spare the flash.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _PERSIST_H_
+#define _PERSIST_H_
+
+#include "esp_err.h"
+
+// Reads what was saved before the last reboot into State. Call once, after
+// initialize_state() and before the control tasks start. Missing or
+// outdated records leave the defaults in place.
+esp_err_t persist_restore();
+
+// Call once the wall clock is valid, e.g. from the SNTP sync callback. An
+// activation time that persist_restore() could not convert without it is
+// applied now, unless the relay has run since.
+void persist_on_time_valid();
+
+// Watches State and writes changed configuration and relay history back to
+// NVS, at most once per PERSIST_*_MIN_INTERVAL_US per class. The RTC
+// snapshot is updated on every change. Never returns.
+void persist_task();
+
+#endif  // _PERSIST_H_
@@ -0,0 +1,195 @@
+#include "policy.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock.h"
+#include "exposure.h"
+
+typedef PolicyDecision (*PolicyFn)(const PolicyParams*, const PolicyInputs*);
+
+static const PolicyDecision no_run = {.next_run_us = THE_END_OF_TIME};
+
+// A run interval_us after the last one, or straight away if there was none
+static PolicyDecision run_after(const PolicyParams* p, const PolicyInputs* in,
+                                int64_t interval_us) {
+  PolicyDecision d = {.run_us = p->run_s * 1000000LL};
+  d.next_run_us = in->last_run_us == CLOCK_NEVER_US
+                      ? 0
+                      : in->last_run_us + interval_us;
+  return d;
+}
+
+// M = MAX / (1 + k * dT) in integers: dT in 1/16 C, k in thousandths. No
+// run at all above the threshold.
+static PolicyDecision formula_for(const PolicyParams* p,
+                                  const PolicyInputs* in, int32_t deficit) {
+  if (deficit < 0) {
+    return no_run;
+  }
+  int64_t one = SAMPLE_RAW_PER_C * 1000;
+  return run_after(p, in,
+                   p->max_interval_s * 1000000LL * one /
+                       (one + (int64_t)p->k_milli * deficit));
+}
+
+static PolicyDecision formula(const PolicyParams* p, const PolicyInputs* in) {
+  return formula_for(p, in, in->threshold - in->temp);
+}
+
+static PolicyDecision stepped(const PolicyParams* p, const PolicyInputs* in) {
+  int32_t deficit = in->threshold - in->temp;
+  int step = -1;
+  for (int i = 0; i < POLICY_STEPS; i++) {
+    if (p->step_deficit[i] <= deficit &&
+        (step < 0 || p->step_deficit[i] > p->step_deficit[step])) {
+      step = i;
+    }
+  }
+  if (step < 0) {
+    return no_run;
+  }
+  return run_after(p, in, p->step_interval_s[step] * 1000000LL);
+}
+
+// When the trend line fits well and is heading lower, the formula acts on
+// where it will be lead_s from now, so circulation starts before the
+// threshold is crossed. The line only ever brings runs forward: at or
+// below the threshold there is always a run, warming or not.
+static PolicyDecision predictive(const PolicyParams* p,
+                                 const PolicyInputs* in) {
+  Temp16 temp = in->temp;
+  if (!in->temp_stale && in->trend.samples >= TREND_MIN_SAMPLES &&
+      in->trend.r2_pct >= p->min_r2_pct) {
+    Temp16 projected = trend_project(&in->trend, p->lead_s);
+    temp = projected < temp ? projected : temp;
+  }
+  return formula_for(p, in, in->threshold - temp);
+}
+
+// A brief dip does not build up enough exposure to start the boiler
+static PolicyDecision exposure(const PolicyParams* p, const PolicyInputs* in) {
+  if (in->exposure < p->exposure_min_deg_min * EXPOSURE_PER_DEG_MIN) {
+    return no_run;
+  }
+  return formula_for(
+      p, in, exposure_sustained_deficit(in->exposure, p->exposure_decay_s));
+}
+
+static const struct {
+  const char* name;
+  PolicyFn decide;
+} policies[POLICY_COUNT] = {
+    [POLICY_FORMULA] = {"formula", formula},
+    [POLICY_STEPPED] = {"stepped", stepped},
+    [POLICY_PREDICTIVE] = {"predictive", predictive},
+    [POLICY_EXPOSURE] = {"exposure", exposure},
+};
+
+#define ENTRY(name, field, scale, min, max) \
+  {name, offsetof(PolicyParams, field), scale, min, max}
+#define PARAM(field, scale, min, max) ENTRY(#field, field, scale, min, max)
+// Temperatures are shown and set in C
+#define STEP(i)                                                       \
+  ENTRY("step" #i "_deficit_c", step_deficit[i], SAMPLE_RAW_PER_C, 0, \
+        50 * SAMPLE_RAW_PER_C),                                       \
+      ENTRY("step" #i "_interval_s", step_interval_s[i], 1, 10, 24 * 60 * 60)
+
+const PolicyParamInfo policy_param_info[] = {
+    PARAM(run_s, 1, 1, 60 * 60),
+    PARAM(max_interval_s, 1, 10, 24 * 60 * 60),
+    PARAM(k_milli, 1, 0, 10000),
+    STEP(0),
+    STEP(1),
+    STEP(2),
+    STEP(3),
+    PARAM(lead_s, 1, 0, 6 * 60 * 60),
+    PARAM(min_r2_pct, 1, 0, 100),
+    PARAM(exposure_min_deg_min, 1, 0, 100000),
+    PARAM(exposure_decay_s, 1, 0, 7 * 24 * 60 * 60),
+};
+const int policy_param_count =
+    sizeof(policy_param_info) / sizeof(policy_param_info[0]);
+
+static int32_t* param(PolicyParams* p, const PolicyParamInfo* info) {
+  return (int32_t*)((char*)p + info->offset);
+}
+
+void policy_defaults(PolicyConfig* c) {
+  *c = (PolicyConfig){
+      .id = POLICY_FORMULA,
+      .params =
+          {
+              .run_s = CIRC_ON_S,
+              .max_interval_s = MAX_CIRC_INTERVAL_S,
+              .k_milli = RELAY_PERIOD_SCALING_MILLI,
+              .step_deficit = POLICY_STEP_DEFICITS,
+              .step_interval_s = POLICY_STEP_INTERVALS_S,
+              .lead_s = TREND_LEAD_S,
+              .min_r2_pct = TREND_MIN_R2_PCT,
+              .exposure_min_deg_min = EXPOSURE_MIN_DEG_MIN,
+              .exposure_decay_s = EXPOSURE_DECAY_S,
+          },
+  };
+}
+
+const char* policy_invalid(const PolicyConfig* c) {
+  if (c->id >= POLICY_COUNT) {
+    return "unknown policy";
+  }
+  for (int i = 0; i < policy_param_count; i++) {
+    const PolicyParamInfo* info = &policy_param_info[i];
+    int32_t v = *param((PolicyParams*)&c->params, info);
+    if (v < info->min || v > info->max) {
+      return info->name;
+    }
+  }
+  // Or the relay would be on nearly all the time
+  const PolicyParams* p = &c->params;
+  if (p->run_s >= p->max_interval_s) {
+    return "run_s not below max_interval_s";
+  }
+  for (int i = 0; i < POLICY_STEPS; i++) {
+    if (p->run_s >= p->step_interval_s[i]) {
+      return "run_s not below every step interval";
+    }
+  }
+  return NULL;
+}
+
+PolicyDecision policy_decide(const PolicyConfig* c, const PolicyInputs* in) {
+  if (c->id >= POLICY_COUNT) {
+    return no_run;
+  }
+  return policies[c->id].decide(&c->params, in);
+}
+
+const char* policy_name(PolicyId id) {
+  return id < POLICY_COUNT ? policies[id].name : "unknown";
+}
+
+bool policy_from_name(const char* name, PolicyId* id) {
+  for (int i = 0; i < POLICY_COUNT; i++) {
+    if (strcmp(name, policies[i].name) == 0) {
+      *id = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+float policy_param_get(const PolicyParams* p, const PolicyParamInfo* info) {
+  return (float)*param((PolicyParams*)p, info) / info->scale;
+}
+
+bool policy_param_set(PolicyParams* p, const PolicyParamInfo* info,
+                      const char* value) {
+  char* end;
+  double v = strtod(value, &end) * info->scale;
+  if (end == value || *end != '\0' || !(v >= info->min && v <= info->max)) {
+    return false;
+  }
+  // Rounded to the nearest stored unit, e.g. 1/16 C
+  *param(p, info) = v < 0 ? v - 0.5 : v + 0.5;
+  return true;
+}
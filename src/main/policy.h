@@ -0,0 +1,99 @@
+/*
+ * Control policies: when the boiler should next circulate and for how long.
+ * Each policy is a plain function of the latest sample, trend, exposure and
+ * last run, with parameters that can be changed at run time. No allocation,
+ * cheap enough to run on every sample. Pure C, no FreeRTOS, so it can also
+ * be built on a host.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _POLICY_H_
+#define _POLICY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "sample.h"
+#include "trend.h"
+
+#define POLICY_STEPS 4
+
+typedef enum {
+  POLICY_FORMULA = 0,  // M = max / (1 + k * dT) on the current temperature
+  POLICY_STEPPED,      // Interval looked up from a table of deficits
+  POLICY_PREDICTIVE,   // The formula on where the trend line is heading
+  POLICY_EXPOSURE,     // The formula on the deficit freeze exposure implies
+  POLICY_COUNT,
+} PolicyId;
+
+// Every field is int32_t, so there is no padding and the struct can be
+// saved and compared whole. Temperatures are 1/16 C.
+typedef struct {
+  int32_t run_s;           // Circulation pulse
+  int32_t max_interval_s;  // Between pulses at the threshold
+  int32_t k_milli;         // k in the formula, per C, in thousandths
+  // Stepped: the interval for the largest deficit not above the current one
+  int32_t step_deficit[POLICY_STEPS];
+  int32_t step_interval_s[POLICY_STEPS];
+  // Predictive: act on the line this far ahead when it fits this well
+  int32_t lead_s;
+  int32_t min_r2_pct;
+  // Exposure: nothing below this much, see exposure.h for the decay
+  int32_t exposure_min_deg_min;
+  int32_t exposure_decay_s;
+} PolicyParams;
+
+typedef struct {
+  PolicyId id;
+  PolicyParams params;
+} PolicyConfig;
+
+typedef struct {
+  Temp16 temp;
+  bool temp_stale;
+  Temp16 threshold;
+  TrendEstimate trend;
+  int32_t exposure;     // 1/16 C minutes
+  int64_t last_run_us;  // Monotonic, CLOCK_NEVER_US if not yet
+} PolicyInputs;
+
+typedef struct {
+  int64_t next_run_us;  // Monotonic, THE_END_OF_TIME if none is needed
+  int64_t run_us;
+} PolicyDecision;
+
+// A tunable parameter, in the units it is shown and set in
+typedef struct {
+  const char* name;
+  size_t offset;  // In PolicyParams
+  int32_t scale;  // Stored units per shown unit, e.g. SAMPLE_RAW_PER_C
+  int32_t min;    // Stored units
+  int32_t max;
+} PolicyParamInfo;
+
+extern const PolicyParamInfo policy_param_info[];
+extern const int policy_param_count;
+
+void policy_defaults(PolicyConfig*);
+// Checks for a known policy, every parameter in range and a run shorter
+// than the intervals. Returns what is wrong, or NULL if nothing is.
+const char* policy_invalid(const PolicyConfig*);
+PolicyDecision policy_decide(const PolicyConfig*, const PolicyInputs*);
+
+const char* policy_name(PolicyId);
+// False if there is no policy by that name
+bool policy_from_name(const char* name, PolicyId*);
+
+// The parameter in shown units, e.g. 2.5 for a 2.5 C step
+float policy_param_get(const PolicyParams*, const PolicyParamInfo*);
+// False, and nothing changed, if the value is not a number or out of range
+bool policy_param_set(PolicyParams*, const PolicyParamInfo*,
+                      const char* value);
+
+#endif  // _POLICY_H_
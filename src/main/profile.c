@@ -0,0 +1,186 @@
+#include "profile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "clock.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static const char* TAG = "profile";
+
+static const uint32_t heap_caps[PROFILE_HEAP_COUNT] = {
+    [PROFILE_HEAP_INTERNAL] = MALLOC_CAP_INTERNAL,
+    [PROFILE_HEAP_DEFAULT] = MALLOC_CAP_DEFAULT,
+    [PROFILE_HEAP_DMA] = MALLOC_CAP_DMA,
+};
+
+static const char* heap_names[PROFILE_HEAP_COUNT] = {
+    [PROFILE_HEAP_INTERNAL] = "internal",
+    [PROFILE_HEAP_DEFAULT] = "default",
+    [PROFILE_HEAP_DMA] = "dma",
+};
+
+// Guards everything below. Readers format text, too slow for a critical
+// section.
+static SemaphoreHandle_t profile_lock;
+
+static TaskProfile tasks[PROFILE_MAX_TASKS];
+static uint8_t task_count;
+static uint32_t last_total_run_time;
+
+static ProfileSample history[PROFILE_HISTORY_LENGTH];
+static uint8_t history_next;
+static uint8_t history_count;
+
+// Scratch space, static to keep it off the stack
+static TaskStatus_t statuses[PROFILE_MAX_TASKS];
+static TaskProfile updated[PROFILE_MAX_TASKS];
+
+static void sample_heaps(ProfileSample* sample) {
+  for (int i = 0; i < PROFILE_HEAP_COUNT; i++) {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, heap_caps[i]);
+    HeapProfile* heap = &sample->heaps[i];
+    heap->free_bytes = info.total_free_bytes;
+    heap->min_free_bytes = info.minimum_free_bytes;
+    heap->largest_block_bytes = info.largest_free_block;
+    heap->fragmentation_percent =
+        info.total_free_bytes
+            ? 100 - info.largest_free_block * 100 / info.total_free_bytes
+            : 0;
+  }
+}
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+
+static const TaskProfile* find_task(UBaseType_t number) {
+  for (int i = 0; i < task_count; i++) {
+    if (tasks[i].number == number) {
+      return &tasks[i];
+    }
+  }
+  return NULL;
+}
+
+static void sample_tasks(ProfileSample* sample) {
+  uint32_t total_run_time;
+  UBaseType_t count =
+      uxTaskGetSystemState(statuses, PROFILE_MAX_TASKS, &total_run_time);
+  if (count == 0) {
+    ESP_LOGW(TAG, "More than %d tasks, not profiled", PROFILE_MAX_TASKS);
+    return;
+  }
+  // Run time counters are per core, so is the elapsed total
+  uint32_t elapsed = total_run_time - last_total_run_time;
+  last_total_run_time = total_run_time;
+
+  TaskHandle_t idle[portNUM_PROCESSORS];
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    idle[core] = xTaskGetIdleTaskHandleForCore(core);
+    sample->core_busy_percent[core] = 0;
+  }
+
+  // Build the new table next to the old one, since deltas need both
+  for (int i = 0; i < count; i++) {
+    const TaskStatus_t* status = &statuses[i];
+    TaskProfile* task = &updated[i];
+    strlcpy(task->name, status->pcTaskName, sizeof(task->name));
+    task->number = status->xTaskNumber;
+    task->priority = status->uxCurrentPriority;
+    // High-water marks are in bytes on the ESP32, like stack sizes
+    task->stack_free_bytes = status->usStackHighWaterMark;
+    task->run_time = status->ulRunTimeCounter;
+    const TaskProfile* previous = find_task(task->number);
+    uint32_t ran = previous ? task->run_time - previous->run_time
+                            : task->run_time;
+    task->cpu_percent = elapsed ? (uint64_t)ran * 100 / elapsed : 0;
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+      if (status->xHandle == idle[core]) {
+        sample->core_busy_percent[core] =
+            task->cpu_percent < 100 ? 100 - task->cpu_percent : 0;
+      }
+    }
+  }
+  memcpy(tasks, updated, count * sizeof(TaskProfile));
+  task_count = count;
+  sample->task_count = count;
+}
+
+#else
+
+static void sample_tasks(ProfileSample* sample) {
+  // Needs CONFIG_FREERTOS_USE_TRACE_FACILITY and
+  // CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS, see sdkconfig.defaults
+  sample->task_count = uxTaskGetNumberOfTasks();
+}
+
+#endif
+
+void profile_task() {
+  profile_lock = xSemaphoreCreateMutex();
+  while (true) {
+    ProfileSample sample = {.timestamp_us = clock_now_us()};
+    xSemaphoreTake(profile_lock, portMAX_DELAY);
+    sample_heaps(&sample);
+    sample_tasks(&sample);
+    history[history_next] = sample;
+    history_next = (history_next + 1) % PROFILE_HISTORY_LENGTH;
+    if (history_count < PROFILE_HISTORY_LENGTH) {
+      history_count++;
+    }
+    xSemaphoreGive(profile_lock);
+    vTaskDelay(PROFILE_PERIOD_TICKS);
+  }
+}
+
+// Once truncated, only count the length: buf + len may be past the end
+#define APPEND(...)                                          \
+  len += snprintf(len < size ? buf + len : NULL,             \
+                  len < size ? size - len : 0, __VA_ARGS__)
+
+size_t profile_format(char* buf, size_t size) {
+  size_t len = 0;
+  if (profile_lock == NULL) {
+    APPEND("Profiler not started\n");
+    return len;
+  }
+
+  xSemaphoreTake(profile_lock, portMAX_DELAY);
+  APPEND("task priority stack_free_bytes cpu_percent\n");
+  for (int i = 0; i < task_count; i++) {
+    APPEND("%-16s %2u %6lu %3u\n", tasks[i].name,
+           (unsigned)tasks[i].priority,
+           (unsigned long)tasks[i].stack_free_bytes,
+           (unsigned)tasks[i].cpu_percent);
+  }
+
+  APPEND("\nage_s tasks busy_percent(core 0/1) heap free/min_free/largest/"
+         "fragmentation_percent\n");
+  int64_t now_us = clock_now_us();
+  for (int n = 0; n < history_count; n++) {
+    int i = (history_next + PROFILE_HISTORY_LENGTH - 1 - n) %
+            PROFILE_HISTORY_LENGTH;
+    const ProfileSample* sample = &history[i];
+    APPEND("%5lld %3u", (long long)(now_us - sample->timestamp_us) / 1000000,
+           (unsigned)sample->task_count);
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+      APPEND("%s%u", core ? "/" : " ",
+             (unsigned)sample->core_busy_percent[core]);
+    }
+    for (int h = 0; h < PROFILE_HEAP_COUNT; h++) {
+      const HeapProfile* heap = &sample->heaps[h];
+      APPEND(" %s %lu/%lu/%lu/%u", heap_names[h],
+             (unsigned long)heap->free_bytes,
+             (unsigned long)heap->min_free_bytes,
+             (unsigned long)heap->largest_block_bytes,
+             (unsigned)heap->fragmentation_percent);
+    }
+    APPEND("\n");
+  }
+  xSemaphoreGive(profile_lock);
+  return len;
+}
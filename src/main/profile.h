@@ -0,0 +1,60 @@
+/*
+ * Samples task run time, stack high-water marks and heap use at a fixed
+ * period, so task stacks can be sized from data and spare RAM found.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "freertos/FreeRTOS.h"
+
+typedef enum {
+  PROFILE_HEAP_INTERNAL = 0,  // Internal RAM
+  PROFILE_HEAP_DEFAULT,       // What malloc() hands out
+  PROFILE_HEAP_DMA,
+  PROFILE_HEAP_COUNT,
+} ProfileHeap;
+
+typedef struct {
+  uint32_t free_bytes;
+  uint32_t min_free_bytes;  // Low water mark since boot
+  uint32_t largest_block_bytes;
+  // How much of the free memory is not in the largest block, 0-100
+  uint8_t fragmentation_percent;
+} HeapProfile;
+
+// Latest period, per task
+typedef struct {
+  char name[configMAX_TASK_NAME_LEN];
+  UBaseType_t number;  // Unique per task, to follow it between samples
+  UBaseType_t priority;
+  uint32_t stack_free_bytes;  // Least free stack ever, the high-water mark
+  uint32_t run_time;          // Run time counter at the last sample
+  uint8_t cpu_percent;        // Share of one core over the last period
+} TaskProfile;
+
+// One entry of the rolling history
+typedef struct {
+  int64_t timestamp_us;
+  HeapProfile heaps[PROFILE_HEAP_COUNT];
+  uint8_t core_busy_percent[portNUM_PROCESSORS];
+  uint8_t task_count;
+} ProfileSample;
+
+// Samples every PROFILE_PERIOD_TICKS. Never returns.
+void profile_task();
+
+// Plain text: the latest per-task table, then the history, newest first.
+// Returns the length written, as snprintf.
+size_t profile_format(char* buf, size_t size);
+
+#endif  // _PROFILE_H_
@@ -0,0 +1,233 @@
+#include "relay.h"
+
+#include <esp_log.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "boot.h"
+#include "clock.h"
+#include "constants.h"
+#include "driver/gpio.h"
+#include "driver/gptimer.h"
+#include "esp_attr.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "eventlog.h"
+#include "metrics.h"
+#include "summary.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "hal/gpio_ll.h"
+
+// Set from the pulse timer ISR, alongside the State change bits
+#define RELAY_PULSE_DONE BIT7
+
+static const char* TAG = "relay";
+
+static esp_timer_handle_t activate_timer;
+static EventGroupHandle_t events;
+
+// The on-pulse is ended by a hardware timer alarm, so its length does not
+// depend on any task getting the CPU. The ISR and everything it touches are
+// in IRAM or DRAM (CONFIG_GPTIMER_ISR_IRAM_SAFE), so it also runs on time
+// while the flash cache is off for a flash log erase or write.
+static gptimer_handle_t pulse_timer;
+static volatile int pulse_pin;
+static volatile int64_t pulse_run_us;
+static volatile int64_t pulse_start_us;
+static volatile int64_t pulse_width_us;
+static RelayPulseStats pulse_stats;
+
+PolicyDecision get_relay_decision(const State* state) {
+  PolicyInputs inputs = {
+      .temp = state->outside_temp,
+      .temp_stale = state->outside_temp_stale,
+      .threshold = state->freeze_danger_temp,
+      .trend = state->outside_trend,
+      .exposure = state->freeze_exposure,
+      .last_run_us = state->relay_activated_us,
+  };
+  return policy_decide(&state->policy, &inputs);
+}
+
+static bool IRAM_ATTR pulse_done_isr(gptimer_handle_t timer,
+                                     const gptimer_alarm_event_data_t* edata,
+                                     void* user_ctx) {
+  // gpio_set_level() is in flash; the LL call is inlined here
+  gpio_ll_set_level(GPIO_LL_GET_HW(GPIO_PORT_0), pulse_pin, 0);
+  pulse_width_us = esp_timer_get_time() - pulse_start_us;
+  gptimer_stop(timer);
+
+  BaseType_t higher_priority_task_woken = pdFALSE;
+  xEventGroupSetBitsFromISR(events, RELAY_PULSE_DONE,
+                            &higher_priority_task_woken);
+  return higher_priority_task_woken == pdTRUE;
+}
+
+// Bookkeeping for a pulse the ISR has already ended
+static void pulse_done() {
+  int64_t width_us = pulse_width_us;
+  if (llabs(width_us - pulse_run_us) > RELAY_PULSE_TOLERANCE_US) {
+    ESP_LOGW(TAG, "Relay pulse took %lld us, wanted %lld us", width_us,
+             (int64_t)pulse_run_us);
+  }
+  pulse_stats.last_us = width_us;
+  if (pulse_stats.count == 0 || width_us < pulse_stats.min_us) {
+    pulse_stats.min_us = width_us;
+  }
+  if (width_us > pulse_stats.max_us) {
+    pulse_stats.max_us = width_us;
+  }
+  pulse_stats.sum_us += width_us;
+  pulse_stats.count++;
+  set_relay_pulse_stats(&pulse_stats);
+  eventlog_append(EVENT_RELAY_OFF, width_us / 1000000LL);
+  summary_add_relay_on(pulse_start_us, width_us);
+  set_relay_deactivated();
+}
+
+static void init_pulse_timer() {
+  if (pulse_timer != NULL) {
+    return;  // Already set up for the pulse check
+  }
+  events = xEventGroupCreate();
+  gptimer_config_t timer_config = {
+      .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+      .direction = GPTIMER_COUNT_UP,
+      .resolution_hz = 1000000,  // 1 us per count
+  };
+  ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &pulse_timer));
+  gptimer_event_callbacks_t callbacks = {.on_alarm = pulse_done_isr};
+  ESP_ERROR_CHECK(
+      gptimer_register_event_callbacks(pulse_timer, &callbacks, NULL));
+  ESP_ERROR_CHECK(gptimer_enable(pulse_timer));
+}
+
+// Switches the pin on and arms the alarm that switches it off
+static void start_pulse(int pin, int64_t run_us) {
+  gptimer_alarm_config_t alarm_config = {
+      .alarm_count = run_us,
+      .flags.auto_reload_on_alarm = false,
+  };
+  ESP_ERROR_CHECK(gptimer_set_alarm_action(pulse_timer, &alarm_config));
+  ESP_ERROR_CHECK(gptimer_set_raw_count(pulse_timer, 0));
+  pulse_pin = pin;
+  pulse_run_us = run_us;
+  pulse_start_us = esp_timer_get_time();
+  gpio_set_level(pin, 1);
+  ESP_ERROR_CHECK(gptimer_start(pulse_timer));
+}
+
+// Runs in the esp_timer task, which is high priority
+static void activate(void* arg) {
+  // The scheduler may have armed this from a snapshot that is now out of
+  // date, so check the decision again before switching on
+  State state = get_state();
+  int64_t now_us = clock_now_us();
+  PolicyDecision decision = get_relay_decision(&state);
+  if (state.relay_on || now_us < decision.next_run_us) {
+    return;
+  }
+  // The run time is the policy's, so the alarm is set for each pulse
+  start_pulse(RELAY_PIN, decision.run_us);
+  set_relay_activated(now_us);
+  eventlog_append(EVENT_RELAY_ON, state.outside_temp);
+}
+
+static void schedule() {
+  State state = get_state();
+  // After a soft reset State starts from the snapshot, which is not stale,
+  // so only a decision after this boot's first sample counts
+  if (!state.outside_temp_stale && boot_phase_us(BOOT_FIRST_SAMPLE) >= 0) {
+    boot_mark(BOOT_FIRST_DECISION);
+  }
+  esp_timer_stop(activate_timer);  // Not running is fine
+  if (state.relay_on) {
+    return;  // Rescheduled when the relay switches off
+  }
+
+  int64_t next_us = get_relay_decision(&state).next_run_us;
+  if (next_us == THE_END_OF_TIME) {
+    ESP_LOGD(TAG, "No activation scheduled");
+    return;
+  }
+  int64_t now_us = clock_now_us();
+  int64_t delay_us = next_us > now_us ? next_us - now_us : 0;
+  ESP_LOGD(TAG, "Next activation in %lld s", delay_us / 1000000LL);
+  ESP_ERROR_CHECK(esp_timer_start_once(activate_timer, delay_us));
+}
+
+void relay_scheduler_task() {
+  gpio_set_direction(RELAY_PIN, GPIO_MODE_OUTPUT);
+  gpio_set_level(RELAY_PIN, 0);
+
+  esp_timer_create_args_t activate_args = {
+      .callback = activate,
+      .name = "relay on",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&activate_args, &activate_timer));
+
+  init_pulse_timer();
+  ESP_ERROR_CHECK(state_subscribe(events, STATE_CHANGED_ALL));
+  while (true) {
+    int64_t decision_start_us = metric_start();
+    schedule();
+    metric_end(METRIC_RELAY_DECISION, decision_start_us);
+    EventBits_t bits =
+        xEventGroupWaitBits(events, STATE_CHANGED_ALL | RELAY_PULSE_DONE,
+                            pdTRUE, pdFALSE, portMAX_DELAY);
+    if (bits & RELAY_PULSE_DONE) {
+      pulse_done();
+    }
+  }
+}
+
+#if CONFIG_RELAY_PULSE_CHECK
+void run_relay_pulse_check() {
+  const esp_partition_t* scratch = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, RELAY_PULSE_CHECK_PARTITION_SUBTYPE,
+      RELAY_PULSE_CHECK_PARTITION);
+  if (scratch == NULL) {
+    ESP_LOGE(TAG, "Pulse check: no " RELAY_PULSE_CHECK_PARTITION
+                  " partition");
+    return;
+  }
+  init_pulse_timer();
+  gpio_set_direction(LED_PIN, GPIO_MODE_OUTPUT);
+  static uint8_t page[256];
+  memset(page, 0xa5, sizeof(page));
+
+  // Every other pulse runs over a sector erase and a sector of page
+  // writes, each longer than the pulse, with the cache off throughout
+  int64_t worst_us[2] = {0, 0};
+  for (int i = 0; i < RELAY_PULSE_CHECK_COUNT; i++) {
+    bool flash = i % 2;
+    xEventGroupClearBits(events, RELAY_PULSE_DONE);
+    start_pulse(LED_PIN, RELAY_PULSE_CHECK_US);
+    if (flash) {
+      ESP_ERROR_CHECK(
+          esp_partition_erase_range(scratch, 0, scratch->erase_size));
+      for (size_t offset = 0; offset < scratch->erase_size;
+           offset += sizeof(page)) {
+        ESP_ERROR_CHECK(
+            esp_partition_write(scratch, offset, page, sizeof(page)));
+      }
+    }
+    xEventGroupWaitBits(events, RELAY_PULSE_DONE, pdTRUE, pdFALSE,
+                        portMAX_DELAY);
+    int64_t error_us = llabs(pulse_width_us - RELAY_PULSE_CHECK_US);
+    if (error_us > worst_us[flash]) {
+      worst_us[flash] = error_us;
+    }
+  }
+
+  ESP_LOGI(TAG, "Pulse check: %lld us pulses off by at most %lld us idle, "
+           "%lld us over flash erase and writes", RELAY_PULSE_CHECK_US,
+           worst_us[0], worst_us[1]);
+  if (worst_us[0] > RELAY_PULSE_TOLERANCE_US ||
+      worst_us[1] > RELAY_PULSE_TOLERANCE_US) {
+    ESP_LOGE(TAG, "Pulse check failed, tolerance is %d us",
+             RELAY_PULSE_TOLERANCE_US);
+  }
+}
+#endif
@@ -0,0 +1,34 @@
+/*
+ * Schedules the circulation relay on esp_timer deadlines.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _RELAY_H_
+#define _RELAY_H_
+
+#include <time.h>
+
+#include "state.h"
+
+// The active policy's decision for a State snapshot: when the relay should
+// next be switched on, in monotonic time, and for how long
+PolicyDecision get_relay_decision(const State*);
+
+// Times short pulses of the relay's pulse timer on the LED pin, the relay
+// is not switched, half of them while the flash cache is off for a sector
+// erase and writes, and logs whether each ended within
+// RELAY_PULSE_TOLERANCE_US. Blocks for a second or so. Call before
+// relay_scheduler_task() starts. Enabled with CONFIG_RELAY_PULSE_CHECK.
+void run_relay_pulse_check();
+
+// Arms a one-shot timer for the next activation and re-arms it only when the
+// temperature, threshold or relay state changes. The on-pulse itself is
+// timed by a hardware timer whose ISR switches the relay off after the
+// policy's run time. Never returns.
+void relay_scheduler_task();
+
+#endif  // _RELAY_H_
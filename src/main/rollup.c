@@ -0,0 +1,113 @@
+#include "rollup.h"
+
+#include <string.h>
+
+void rollup_tier_init(RollupTier* tier, uint32_t period_s, RollupRow* rows,
+                      uint32_t capacity) {
+  *tier = (RollupTier){
+      .period_s = period_s, .capacity = capacity, .rows = rows};
+  memset(rows, 0, capacity * sizeof(RollupRow));
+}
+
+// Floor, so times before the epoch do not round towards it
+static int64_t floor_div(int64_t a, int64_t b) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static int64_t period_of(const RollupTier* tier, int64_t time_s) {
+  return floor_div(time_s, tier->period_s);
+}
+
+static RollupRow* row_at(const RollupTier* tier, int64_t period) {
+  int64_t lap = floor_div(period, tier->capacity);
+  return &tier->rows[period - lap * tier->capacity];
+}
+
+static uint16_t lap_of(const RollupTier* tier, int64_t period) {
+  return (uint16_t)floor_div(period, tier->capacity);
+}
+
+// Returns the row for a period, empty if it was stale, and moves the ring
+// forward to it if it is new. NULL if the period is older than the ring
+// holds.
+static RollupRow* row_for(RollupTier* tier, int64_t period) {
+  if (tier->used == 0) {
+    tier->used = 1;
+    tier->newest = period;
+  } else if (period > tier->newest) {
+    int64_t used = tier->used + (period - tier->newest);
+    tier->used = used > tier->capacity ? tier->capacity : (uint32_t)used;
+    tier->newest = period;
+  } else {
+    int64_t age = tier->newest - period;
+    if (age >= tier->capacity) {
+      return NULL;
+    }
+    if (age >= tier->used) {
+      tier->used = age + 1;
+    }
+  }
+  RollupRow* row = row_at(tier, period);
+  uint16_t lap = lap_of(tier, period);
+  if (row->lap != lap) {
+    *row = (RollupRow){.lap = lap};
+  }
+  return row;
+}
+
+static void add_sample(RollupTier* tier, int64_t time_s, int16_t raw) {
+  RollupRow* row = row_for(tier, period_of(tier, time_s));
+  if (row == NULL) {
+    return;
+  }
+  if (row->count == 0 || raw < row->min_raw) {
+    row->min_raw = raw;
+  }
+  if (row->count == 0 || raw > row->max_raw) {
+    row->max_raw = raw;
+  }
+  if (row->count < UINT16_MAX) {
+    row->sum_raw += raw;
+    row->count++;
+  }
+}
+
+static void add_relay_on(RollupTier* tier, int64_t start_s, uint32_t seconds) {
+  while (seconds > 0) {
+    int64_t period = period_of(tier, start_s);
+    int64_t period_end_s = (period + 1) * tier->period_s;
+    uint32_t part = period_end_s - start_s < seconds
+                        ? (uint32_t)(period_end_s - start_s)
+                        : seconds;
+    RollupRow* row = row_for(tier, period);
+    if (row) {
+      row->relay_on_s += part;
+    }
+    start_s += part;
+    seconds -= part;
+  }
+}
+
+void rollup_add_sample(Rollups* r, int64_t time_s, int16_t raw) {
+  add_sample(&r->hours, time_s, raw);
+  add_sample(&r->days, time_s, raw);
+}
+
+void rollup_add_relay_on(Rollups* r, int64_t start_s, uint32_t seconds) {
+  add_relay_on(&r->hours, start_s, seconds);
+  add_relay_on(&r->days, start_s, seconds);
+}
+
+bool rollup_get(const RollupTier* tier, uint32_t age, RollupRow* row,
+                int64_t* start_s) {
+  if (age >= tier->used) {
+    return false;
+  }
+  int64_t period = tier->newest - age;
+  *row = *row_at(tier, period);
+  if (row->lap != lap_of(tier, period)) {
+    *row = (RollupRow){0};
+  }
+  *start_s = period * tier->period_s;
+  return true;
+}
@@ -0,0 +1,65 @@
+/*
+ * Hourly and daily summaries of the temperature and relay, kept up to date
+ * as samples arrive, each tier in its own fixed ring. Pure C, no FreeRTOS,
+ * so it can also be built on a host.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _ROLLUP_H_
+#define _ROLLUP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ROLLUP_HOUR_S 3600
+#define ROLLUP_DAY_S 86400
+
+typedef struct {
+  int32_t sum_raw;  // For the mean, 1/16 C
+  uint32_t relay_on_s;
+  int16_t min_raw;
+  int16_t max_raw;
+  uint16_t count;  // Samples, zero for a period with none
+  uint16_t lap;    // Of the ring, see RollupTier
+} RollupRow;
+
+// A ring of consecutive periods, where a period index is time_s / period_s.
+// Period p is kept in row p % capacity, with lap p / capacity: a row from
+// an earlier lap is stale and reads as empty. So moving on, however far,
+// clears nothing, and periods can be filled in any order.
+typedef struct {
+  uint32_t period_s;
+  uint32_t capacity;
+  RollupRow* rows;
+  uint32_t used;   // Periods up to and including the newest that are shown
+  int64_t newest;  // Period index of the newest row
+} RollupTier;
+
+typedef struct {
+  RollupTier hours;
+  RollupTier days;
+} Rollups;
+
+void rollup_tier_init(RollupTier*, uint32_t period_s, RollupRow* rows,
+                      uint32_t capacity);
+
+// Times are seconds since the epoch, in the zone periods are cut in: the
+// device passes local time as if it were UTC. A time a whole ring or more
+// older than the newest row of a tier is dropped from that tier.
+void rollup_add_sample(Rollups*, int64_t time_s, int16_t raw);
+// Splits the on time across the periods it spans
+void rollup_add_relay_on(Rollups*, int64_t start_s, uint32_t seconds);
+
+// The row age periods before the newest, with the start of its period.
+// False past the oldest row.
+bool rollup_get(const RollupTier*, uint32_t age, RollupRow*, int64_t* start_s);
+
+static inline int16_t rollup_mean_raw(const RollupRow* row) {
+  return row->count ? row->sum_raw / row->count : 0;
+}
+
+#endif  // _ROLLUP_H_
@@ -0,0 +1,139 @@
+#include "sample.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// DS18B20 measurement range, -55 C to +125 C
+#define SAMPLE_RAW_MIN (-55 * SAMPLE_RAW_PER_C)
+#define SAMPLE_RAW_MAX (125 * SAMPLE_RAW_PER_C)
+
+void sample_jitter_update(SampleJitter* j, const Sample* s, int64_t period_us) {
+  if (j->count > 0) {
+    int64_t slots = (s->scheduled_us - j->previous_scheduled_us) / period_us;
+    if (slots > 1) {
+      j->missed += slots - 1;
+    }
+  }
+  j->previous_scheduled_us = s->scheduled_us;
+
+  j->last_us = s->timestamp_us - s->scheduled_us;
+  int64_t magnitude = j->last_us < 0 ? -j->last_us : j->last_us;
+  if (magnitude > j->max_us) {
+    j->max_us = magnitude;
+  }
+  j->sum_us += magnitude;
+  j->count++;
+}
+
+int64_t sample_jitter_mean_us(const SampleJitter* j) {
+  return j->count ? j->sum_us / j->count : 0;
+}
+
+void sample_pipeline_init(SamplePipeline* p) { memset(p, 0, sizeof(*p)); }
+
+static void sorted_remove(SamplePipeline* p, int16_t v) {
+  uint8_t i = 0;
+  while (i < p->count && p->sorted[i] != v) {
+    i++;
+  }
+  memmove(&p->sorted[i], &p->sorted[i + 1],
+          (p->count - i - 1) * sizeof(p->sorted[0]));
+  p->count--;
+}
+
+static void sorted_insert(SamplePipeline* p, int16_t v) {
+  uint8_t i = p->count;
+  while (i > 0 && p->sorted[i - 1] > v) {
+    p->sorted[i] = p->sorted[i - 1];
+    i--;
+  }
+  p->sorted[i] = v;
+  p->count++;
+}
+
+static void window_push(SamplePipeline* p, int16_t v) {
+  if (p->count == SAMPLE_FILTER_WINDOW) {
+    sorted_remove(p, p->window[p->next]);
+  }
+  p->window[p->next] = v;
+  p->next = (p->next + 1) % SAMPLE_FILTER_WINDOW;
+  sorted_insert(p, v);
+}
+
+// The deviations from the median grow monotonically as we walk outwards from
+// it in the sorted window, so the median deviation is a merge of the two
+// sides, O(window).
+static int16_t median_absolute_deviation(const SamplePipeline* p,
+                                         uint8_t median_index) {
+  int16_t median = p->sorted[median_index];
+  int lo = median_index - 1;
+  int hi = median_index + 1;
+  int16_t deviation = 0;
+  for (int k = 0; k < median_index; k++) {
+    int16_t dlo = lo >= 0 ? median - p->sorted[lo] : INT16_MAX;
+    int16_t dhi = hi < p->count ? p->sorted[hi] - median : INT16_MAX;
+    if (dlo <= dhi) {
+      deviation = dlo;
+      lo--;
+    } else {
+      deviation = dhi;
+      hi++;
+    }
+  }
+  return deviation;
+}
+
+static bool is_outlier(const SamplePipeline* p, int16_t v) {
+  if (p->count < SAMPLE_FILTER_MIN_COUNT) {
+    return false;
+  }
+  uint8_t median_index = (p->count - 1) / 2;
+  int32_t median = p->sorted[median_index];
+  int32_t mad = median_absolute_deviation(p, median_index);
+  // 1.4826 * MAD estimates the standard deviation for normal noise
+  int32_t limit = SAMPLE_FILTER_MAD_SCALE * mad * 14826 / 10000;
+  if (limit < SAMPLE_FILTER_MIN_DEVIATION_RAW) {
+    limit = SAMPLE_FILTER_MIN_DEVIATION_RAW;
+  }
+  return abs(v - median) > limit;
+}
+
+SampleStatus sample_pipeline_push(SamplePipeline* p, const Sample* s) {
+  if (s->err != 0) {
+    p->errors++;
+    return SAMPLE_READ_ERROR;
+  }
+  if (s->raw < SAMPLE_RAW_MIN || s->raw > SAMPLE_RAW_MAX) {
+    p->errors++;
+    return SAMPLE_OUT_OF_RANGE;
+  }
+
+  SampleStatus status = is_outlier(p, s->raw) ? SAMPLE_OUTLIER : SAMPLE_OK;
+  window_push(p, s->raw);
+
+  if (status == SAMPLE_OUTLIER) {
+    p->outliers++;
+  } else {
+    p->good++;
+    p->last_good = *s;
+    p->has_good = true;
+  }
+  return status;
+}
+
+bool sample_pipeline_last_good(const SamplePipeline* p, Sample* s) {
+  if (p->has_good) {
+    *s = p->last_good;
+  }
+  return p->has_good;
+}
+
+bool sample_pipeline_is_stale(const SamplePipeline* p, int64_t now_us,
+                              int64_t max_age_us) {
+  return !p->has_good || now_us - p->last_good.timestamp_us > max_age_us;
+}
+
+void sample_pipeline_shift_time(SamplePipeline* p, int64_t offset_us) {
+  p->last_good.scheduled_us += offset_us;
+  p->last_good.timestamp_us += offset_us;
+}
@@ -0,0 +1,87 @@
+/*
+ * Sample records and the filtering stage between the temperature probe and
+ * the control law. Pure C, no FreeRTOS, so it can also be built on a host.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _SAMPLE_H_
+#define _SAMPLE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "constants.h"
+
+// The DS18B20 reports temperature in 1/16 C. Temperatures stay in that
+// fixed point form through State, the logs and the control law, so
+// comparisons are exact; they become float only for display.
+#define SAMPLE_RAW_PER_C 16
+typedef int16_t Temp16;
+#define TEMP16_FROM_C(c) ((Temp16)((c) * SAMPLE_RAW_PER_C))
+
+typedef enum {
+  SAMPLE_OK = 0,
+  SAMPLE_READ_ERROR,    // The driver reported an error (CRC, power-on, bus)
+  SAMPLE_OUT_OF_RANGE,  // Outside what the DS18B20 can measure
+  SAMPLE_OUTLIER,       // Too far from the recent median
+} SampleStatus;
+
+typedef struct {
+  int16_t raw;           // 1/16 C
+  int64_t scheduled_us;  // When the sample was due, on the sampling grid
+  int64_t timestamp_us;  // When it was taken. Monotonic, esp_timer_get_time()
+  uint8_t rom_code[8];   // Probe that produced the reading
+  int err;               // DS18B20_ERROR returned by the driver
+} Sample;
+
+// Hampel style filter: a reading is an outlier if it is further than a few
+// (scaled) median absolute deviations from the median of the last
+// SAMPLE_FILTER_WINDOW readings. All readings that pass the read and range
+// checks enter the window, so a genuine step change is accepted once it
+// becomes the median.
+typedef struct {
+  int16_t window[SAMPLE_FILTER_WINDOW];  // Arrival order, a ring
+  int16_t sorted[SAMPLE_FILTER_WINDOW];  // Same values, ascending
+  uint8_t next;
+  uint8_t count;
+
+  bool has_good;
+  Sample last_good;
+
+  uint32_t good;
+  uint32_t errors;
+  uint32_t outliers;
+} SamplePipeline;
+
+// How far samples land from their slot on the sampling grid
+typedef struct {
+  uint32_t count;
+  uint32_t missed;  // Slots skipped because a sample overran its period
+  int64_t last_us;
+  int64_t max_us;
+  int64_t sum_us;
+  int64_t previous_scheduled_us;
+} SampleJitter;
+
+void sample_jitter_update(SampleJitter*, const Sample*, int64_t period_us);
+int64_t sample_jitter_mean_us(const SampleJitter*);
+
+void sample_pipeline_init(SamplePipeline*);
+SampleStatus sample_pipeline_push(SamplePipeline*, const Sample*);
+
+// The value the control law should consume. False until the first good read.
+bool sample_pipeline_last_good(const SamplePipeline*, Sample*);
+bool sample_pipeline_is_stale(const SamplePipeline*, int64_t now_us,
+                              int64_t max_age_us);
+// Moves the pipeline's timestamps onto another clock, e.g. after a reset
+void sample_pipeline_shift_time(SamplePipeline*, int64_t offset_us);
+
+static inline float sample_raw_to_c(int16_t raw) {
+  return raw / (float)SAMPLE_RAW_PER_C;
+}
+
+#endif  // _SAMPLE_H_
@@ -0,0 +1,140 @@
+#include "snapshot.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "clock.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+
+static const char* TAG = "snapshot";
+
+#define SNAPSHOT_MAGIC 0xa17f2ee8
+
+typedef struct {
+  uint32_t magic;
+  uint32_t size;  // Catches a layout change across a firmware update
+  int64_t state_saved_us;
+  State state;
+  // The probes' pipelines hold their recent samples, so this doubles as the
+  // sample ring
+  int64_t probes_saved_us;
+  uint8_t probe_count;
+  Probe probes[TEMP_SENSOR_MAX_PROBES];
+  uint32_t crc;  // Over everything above
+} Snapshot;
+
+// Not touched by the bootloader or startup code
+static RTC_NOINIT_ATTR Snapshot snapshot;
+static portMUX_TYPE snapshot_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Probes from the previous boot, with their times moved onto this boot's
+// clock. Kept apart so later saves cannot overwrite them before the sample
+// task picks them up.
+static uint8_t restored_probe_count;
+static Probe restored_probes[TEMP_SENSOR_MAX_PROBES];
+
+static uint32_t snapshot_crc() {
+  return esp_rom_crc32_le(0, (const uint8_t*)&snapshot,
+                          offsetof(Snapshot, crc));
+}
+
+// RTC memory is only kept across resets that do not cut the power
+static bool reset_keeps_rtc_memory(esp_reset_reason_t reason) {
+  switch (reason) {
+    case ESP_RST_SW:
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static void reset_snapshot() {
+  portENTER_CRITICAL(&snapshot_lock);
+  memset(&snapshot, 0, sizeof(snapshot));
+  snapshot.magic = SNAPSHOT_MAGIC;
+  snapshot.size = sizeof(snapshot);
+  snapshot.crc = snapshot_crc();
+  portEXIT_CRITICAL(&snapshot_lock);
+}
+
+bool snapshot_restore() {
+  esp_reset_reason_t reason = esp_reset_reason();
+  bool valid = reset_keeps_rtc_memory(reason) &&
+               snapshot.magic == SNAPSHOT_MAGIC &&
+               snapshot.size == sizeof(snapshot) &&
+               snapshot.crc == snapshot_crc() &&
+               snapshot.probe_count <= TEMP_SENSOR_MAX_PROBES;
+  if (!valid) {
+    ESP_LOGI(TAG, "No snapshot to restore (reset reason %d)", reason);
+    reset_snapshot();
+    return false;
+  }
+
+  // esp_timer restarts from zero. Monotonic times are moved back by the time
+  // they were saved at, as if the reset took no time; for a soft reset it
+  // takes well under a second.
+  restored_probe_count = snapshot.probe_count;
+  for (int i = 0; i < restored_probe_count; i++) {
+    restored_probes[i] = snapshot.probes[i];
+    sample_pipeline_shift_time(&restored_probes[i].pipeline,
+                               -snapshot.probes_saved_us);
+  }
+
+  // The relay pin comes up low after a reset, whatever State said. NVS may
+  // hold a later activation time if the snapshot missed the last change.
+  State current = get_state();
+  State restored = snapshot.state;
+  restored.relay_on = false;
+  if (restored.relay_activated_us != CLOCK_NEVER_US) {
+    restored.relay_activated_us -= snapshot.state_saved_us;
+  }
+  if (current.relay_activated_us > restored.relay_activated_us) {
+    restored.relay_activated_us = current.relay_activated_us;
+  }
+  // Boot local: the sampling grid starts again
+  restored.sample_jitter = (SampleJitter){0};
+  set_state(&restored);
+
+  ESP_LOGI(TAG, "Restored snapshot: %0.1f C, %d probes (reset reason %d)",
+           sample_raw_to_c(restored.outside_temp), restored_probe_count,
+           reason);
+  return true;
+}
+
+bool snapshot_restore_probe(Probe* probe, const uint8_t rom_code[8]) {
+  for (int i = 0; i < restored_probe_count; i++) {
+    if (memcmp(restored_probes[i].health.rom_code, rom_code,
+               sizeof(restored_probes[i].health.rom_code)) == 0) {
+      *probe = restored_probes[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+void snapshot_save_state(const State* state) {
+  int64_t now_us = clock_now_us();
+  portENTER_CRITICAL(&snapshot_lock);
+  snapshot.state_saved_us = now_us;
+  snapshot.state = *state;
+  snapshot.crc = snapshot_crc();
+  portEXIT_CRITICAL(&snapshot_lock);
+}
+
+void snapshot_save_probes(const Probe* probes, int count) {
+  int64_t now_us = clock_now_us();
+  portENTER_CRITICAL(&snapshot_lock);
+  snapshot.probes_saved_us = now_us;
+  snapshot.probe_count = count;
+  memcpy(snapshot.probes, probes, count * sizeof(Probe));
+  snapshot.crc = snapshot_crc();
+  portEXIT_CRITICAL(&snapshot_lock);
+}
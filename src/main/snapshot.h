@@ -0,0 +1,35 @@
+/*
+ * Keeps a copy of State and the probes' recent samples in RTC memory, which
+ * survives a soft, panic or watchdog reset, so the control loop can pick up
+ * where it left off without waiting for fresh samples.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fusion.h"
+#include "state.h"
+
+// Validates the snapshot left by the previous boot and, if it is good,
+// restores State from it. Call once, after persist_restore() and before the
+// control tasks start. Returns true if the snapshot was used.
+bool snapshot_restore();
+
+// Fills in a probe from the restored snapshot, with its sample ring and
+// health, if the snapshot has one with this ROM code
+bool snapshot_restore_probe(Probe*, const uint8_t rom_code[8]);
+
+// RTC memory does not wear, so these are cheap enough to call on every
+// change
+void snapshot_save_state(const State*);
+void snapshot_save_probes(const Probe*, int count);
+
+#endif  // _SNAPSHOT_H_
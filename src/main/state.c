@@ -1,102 +1,216 @@
 #include "state.h"
 
+#include <stdatomic.h>
+#include <string.h>
+
+#include "clock.h"
 #include "constants.h"
 
-State state;
-SemaphoreHandle_t state_mutex;
+// State is a seqlock. Writers bump the sequence to odd, update, and bump it
+// back to even, all inside a critical section so a writer is never preempted
+// half way through. Readers never block: they copy the struct and retry if
+// the sequence was odd or moved while they were copying. Every reader gets a
+// snapshot from a single moment.
+static State state;
+static atomic_uint state_seq;
+static portMUX_TYPE state_lock = portMUX_INITIALIZER_UNLOCKED;
 
-esp_err_t initialize_state() {
-  state_mutex = xSemaphoreCreateMutex();
-  if (state_mutex == NULL) {
-    printf(
-        "[ERROR] Could not initialize state "
-        "mutex.");
-    return ESP_ERR_INVALID_STATE;
+typedef struct {
+  EventGroupHandle_t events;
+  EventBits_t mask;
+} Subscriber;
+
+static Subscriber subscribers[STATE_MAX_SUBSCRIBERS];
+static atomic_int subscriber_count;
+
+static void begin_write() {
+  portENTER_CRITICAL(&state_lock);
+  atomic_fetch_add_explicit(&state_seq, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+static void end_write() {
+  atomic_thread_fence(memory_order_release);
+  atomic_fetch_add_explicit(&state_seq, 1, memory_order_relaxed);
+  portEXIT_CRITICAL(&state_lock);
+}
+
+// Called after end_write(): setting event bits is not allowed inside the
+// critical section
+static void notify(EventBits_t changed) {
+  int count = atomic_load_explicit(&subscriber_count, memory_order_acquire);
+  for (int i = 0; i < count; i++) {
+    EventBits_t bits = changed & subscribers[i].mask;
+    if (bits) {
+      xEventGroupSetBits(subscribers[i].events, bits);
+    }
   }
-  state.freeze_danger_temp_c = DEFAULT_FREEZE_DANGER_TEMP_C;
-  state.outside_temp_c = 25;  // Takes us a moment to get the temperature and we
-                              // don't want to trigger the relay
-  state.relay_activated_time_s = 0;
+}
+
+esp_err_t state_subscribe(EventGroupHandle_t events, EventBits_t mask) {
+  esp_err_t err = ESP_ERR_NO_MEM;
+  portENTER_CRITICAL(&state_lock);
+  int count = atomic_load_explicit(&subscriber_count, memory_order_relaxed);
+  if (count < STATE_MAX_SUBSCRIBERS) {
+    subscribers[count] = (Subscriber){events, mask};
+    atomic_store_explicit(&subscriber_count, count + 1, memory_order_release);
+    err = ESP_OK;
+  }
+  portEXIT_CRITICAL(&state_lock);
+  return err;
+}
+
+esp_err_t initialize_state() {
+  begin_write();
+  state.freeze_danger_temp = TEMP16_FROM_C(DEFAULT_FREEZE_DANGER_TEMP_C);
+  policy_defaults(&state.policy);
+#if CONFIG_CONTROL_USE_EXPOSURE
+  state.policy.id = POLICY_EXPOSURE;
+#endif
+#if CONFIG_TEST_MODE
+  // Short cycles so a bench test does not take hours
+  state.policy.params.run_s = TEST_CIRC_ON_S;
+  state.policy.params.max_interval_s = TEST_MAX_CIRC_INTERVAL_S;
+#endif
+  // Takes us a moment to get the temperature and we don't want to trigger
+  // the relay
+  state.outside_temp = TEMP16_FROM_C(25);
+  state.outside_temp_stale = true;
+  state.outside_trend = (TrendEstimate){.cross_s = TREND_NEVER};
+  state.freeze_exposure = 0;
+  state.sample_jitter = (SampleJitter){0};
+  state.probe_count = 0;
+  state.relay_activated_us = CLOCK_NEVER_US;
   state.relay_on = false;
+  state.relay_pulse = (RelayPulseStats){0};
+  end_write();
 
   return ESP_OK;
 }
 
-void set_freeze_danger_temp_c(float t) {
-  xSemaphoreTake(state_mutex, portMAX_DELAY);  // block
-  state.freeze_danger_temp_c = t;
-  xSemaphoreGive(state_mutex);
+void set_freeze_danger_temp(Temp16 t) {
+  begin_write();
+  bool changed = state.freeze_danger_temp != t;
+  state.freeze_danger_temp = t;
+  end_write();
+  if (changed) {
+    notify(STATE_CHANGED_THRESHOLD);
+  }
+}
+
+// The threshold and the policy are both configuration, saved together
+void set_policy(const PolicyConfig* policy) {
+  begin_write();
+  bool changed = memcmp(&state.policy, policy, sizeof(*policy)) != 0;
+  state.policy = *policy;
+  end_write();
+  if (changed) {
+    notify(STATE_CHANGED_THRESHOLD);
+  }
 }
 
-float get_freeze_danger_temp_c() {
-  float t;
-  xSemaphoreTake(state_mutex, portMAX_DELAY);  // block
-  t = state.freeze_danger_temp_c;
-  xSemaphoreGive(state_mutex);
-  return t;
+void set_outside_temp(Temp16 t) {
+  begin_write();
+  bool changed = state.outside_temp != t;
+  state.outside_temp = t;
+  end_write();
+  if (changed) {
+    notify(STATE_CHANGED_TEMPERATURE);
+  }
 }
 
-void set_outside_temp_c(float t) {
-  xSemaphoreTake(state_mutex, portMAX_DELAY);  // block
-  state.outside_temp_c = t;
-  xSemaphoreGive(state_mutex);
+void set_outside_temp_stale(bool stale) {
+  begin_write();
+  state.outside_temp_stale = stale;
+  end_write();
 }
 
-float get_outside_temp_c() {
-  float t;
-  xSemaphoreTake(state_mutex, portMAX_DELAY);  // block
-  t = state.outside_temp_c;
-  xSemaphoreGive(state_mutex);
-  return t;
+void set_outside_trend(const TrendEstimate* trend) {
+  begin_write();
+  const TrendEstimate* old = &state.outside_trend;
+  bool changed = old->samples != trend->samples ||
+                 old->slope_per_hour != trend->slope_per_hour ||
+                 old->r2_pct != trend->r2_pct || old->now != trend->now ||
+                 old->cross_s != trend->cross_s;
+  state.outside_trend = *trend;
+  end_write();
+  if (changed) {
+    notify(STATE_CHANGED_TEMPERATURE);
+  }
 }
 
-bool freeze_danger_present() {
-  bool d;
-  xSemaphoreTake(state_mutex, portMAX_DELAY);  // block
-  d = state.outside_temp_c < state.freeze_danger_temp_c;
-  xSemaphoreGive(state_mutex);
-  return d;
+void set_freeze_exposure(int32_t exposure) {
+  begin_write();
+  bool changed = state.freeze_exposure != exposure;
+  state.freeze_exposure = exposure;
+  end_write();
+  if (changed) {
+    notify(STATE_CHANGED_TEMPERATURE);
+  }
 }
 
-void set_relay_activated(time_t t) {
-  xSemaphoreTake(state_mutex, portMAX_DELAY);  // block
-  state.relay_activated_time_s = t;
-  state.relay_on = true;
-  xSemaphoreGive(state_mutex);
+void set_sample_jitter(const SampleJitter* jitter) {
+  begin_write();
+  state.sample_jitter = *jitter;
+  end_write();
 }
 
-time_t get_relay_activated_time_s() {
-  time_t t;
-  xSemaphoreTake(state_mutex, portMAX_DELAY);  // block
-  t = state.relay_activated_time_s;
-  xSemaphoreGive(state_mutex);
-  return t;
+void set_probe_health(const Probe* probes, int count) {
+  begin_write();
+  state.probe_count = count;
+  for (int i = 0; i < count; i++) {
+    state.probe_health[i] = probes[i].health;
+  }
+  end_write();
 }
 
-time_t get_relay_activated_elapsed_time_s() {
-  time_t t = get_relay_activated_time_s();
-  time_t now;
-  time(&now);
-  return now - t;
+bool freeze_danger_present(const State* s) {
+  return s->outside_temp < s->freeze_danger_temp;
 }
 
-bool get_relay_activated() {
-  bool r;
-  xSemaphoreTake(state_mutex, portMAX_DELAY);  // block
-  r = state.relay_on;
-  xSemaphoreGive(state_mutex);
-  return r;
+void set_relay_activated(int64_t now_us) {
+  begin_write();
+  state.relay_activated_us = now_us;
+  state.relay_on = true;
+  end_write();
+  notify(STATE_CHANGED_RELAY);
 }
 
 void set_relay_deactivated() {
-  xSemaphoreTake(state_mutex, portMAX_DELAY);  // block
+  begin_write();
   state.relay_on = false;
-  xSemaphoreGive(state_mutex);
+  end_write();
+  notify(STATE_CHANGED_RELAY);
+}
+
+void set_relay_activated_us(int64_t t) {
+  begin_write();
+  state.relay_activated_us = t;
+  end_write();
+  notify(STATE_CHANGED_RELAY);
+}
+
+void set_relay_pulse_stats(const RelayPulseStats* stats) {
+  begin_write();
+  state.relay_pulse = *stats;
+  end_write();
+}
+
+void set_state(const State* s) {
+  begin_write();
+  state = *s;
+  end_write();
+  notify(STATE_CHANGED_ALL);
 }
 
 State get_state() {
-  xSemaphoreTake(state_mutex, portMAX_DELAY);  // block
-  State state_copy = state;
-  xSemaphoreGive(state_mutex);
+  State state_copy;
+  unsigned begin, end;
+  do {
+    begin = atomic_load_explicit(&state_seq, memory_order_acquire);
+    state_copy = state;
+    atomic_thread_fence(memory_order_acquire);
+    end = atomic_load_explicit(&state_seq, memory_order_relaxed);
+  } while ((begin & 1) || begin != end);
   return state_copy;
 }
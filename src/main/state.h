@@ -1,5 +1,7 @@
 /*
  * Defines a state struct and manages thread safe access to it.
+ * Readers take a consistent snapshot with get_state() without blocking and
+ * can subscribe to be woken when parts of it change.
  * Part of the Antifreeze program. https://github.com/kghose/antifreeze
  *
  * (c) 2024 Kaushik Ghose
@@ -10,37 +12,75 @@
 #ifndef _STATE_H_
 #define _STATE_H_
 
-#include <time.h>
+#include <stdint.h>
 
 #include "freertos/FreeRTOS.h"
-#include "freertos/semphr.h"
-#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "exposure.h"
+#include "fusion.h"
+#include "policy.h"
+#include "sample.h"
+#include "trend.h"
 
+// Measured relay on-pulse widths
 typedef struct {
-  float freeze_danger_temp_c;
-  float outside_temp_c;
+  uint32_t count;
+  int64_t last_us;
+  int64_t min_us;
+  int64_t max_us;
+  int64_t sum_us;
+} RelayPulseStats;
+
+typedef struct {
+  Temp16 freeze_danger_temp;
+  PolicyConfig policy;
+  Temp16 outside_temp;
+  bool outside_temp_stale;
+  TrendEstimate outside_trend;  // As of the last sample, against the
+                                // freeze danger temp
+  int32_t freeze_exposure;      // 1/16 C minutes, see exposure.h
+  SampleJitter sample_jitter;
+  uint8_t probe_count;
+  ProbeHealth probe_health[TEMP_SENSOR_MAX_PROBES];
 
   bool relay_on;
-  time_t relay_activated_time_s;
+  int64_t relay_activated_us;  // Monotonic, CLOCK_NEVER_US if not yet
+  RelayPulseStats relay_pulse;
 
 } State;
 
-esp_err_t initialize_state();
+// Change notification bits. A subscriber passes its own event group and the
+// bits it cares about, and the bits are set when that part of State
+// changes. Bits above STATE_CHANGED_ALL are free for the subscriber's own use.
+#define STATE_CHANGED_TEMPERATURE BIT0
+#define STATE_CHANGED_THRESHOLD BIT1
+#define STATE_CHANGED_RELAY BIT2
+#define STATE_CHANGED_ALL \
+  (STATE_CHANGED_TEMPERATURE | STATE_CHANGED_THRESHOLD | STATE_CHANGED_RELAY)
 
-void set_freeze_danger_temp_c(float);
-float get_freeze_danger_temp_c();
+esp_err_t initialize_state();
 
-void set_outside_temp_c(float);
-float get_outside_temp_c();
+void set_freeze_danger_temp(Temp16);
+void set_policy(const PolicyConfig*);
 
-bool freeze_danger_present();
+void set_outside_temp(Temp16);
+void set_outside_temp_stale(bool);
+void set_outside_trend(const TrendEstimate*);
+void set_freeze_exposure(int32_t);
+void set_sample_jitter(const SampleJitter*);
+void set_probe_health(const Probe*, int count);
 
-void set_relay_activated(time_t);
-time_t get_relay_activated_time_s();
-time_t get_relay_activated_elapsed_time_s();
-bool get_relay_activated();
+void set_relay_activated(int64_t now_us);
 void set_relay_deactivated();
+// Restores the last activation time, e.g. after a reboot, without switching
+// the relay on
+void set_relay_activated_us(int64_t);
+void set_relay_pulse_stats(const RelayPulseStats*);
 
 State get_state();
+// Replaces the whole of State, e.g. from a snapshot taken before a reset
+void set_state(const State*);
+esp_err_t state_subscribe(EventGroupHandle_t, EventBits_t);
+bool freeze_danger_present(const State*);
 
 #endif  //_STATE_H_
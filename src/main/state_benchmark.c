@@ -0,0 +1,105 @@
+#include "state_benchmark.h"
+
+#include <esp_log.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "state.h"
+
+#define BENCHMARK_DURATION_US (2 * 1000000LL)
+#define BENCHMARK_STACK 4096
+
+static const char* TAG = "state benchmark";
+
+typedef struct {
+  bool use_mutex;
+  volatile bool* running;
+  SemaphoreHandle_t done;
+  uint32_t count;
+} BenchmarkArgs;
+
+// Stand-in for the old mutex-per-access State
+static State mutex_state;
+static SemaphoreHandle_t mutex_state_mutex;
+
+static void reader_task(void* pvParameter) {
+  BenchmarkArgs* args = (BenchmarkArgs*)pvParameter;
+  volatile Temp16 sink;
+  while (*args->running) {
+    State s;
+    if (args->use_mutex) {
+      xSemaphoreTake(mutex_state_mutex, portMAX_DELAY);
+      s = mutex_state;
+      xSemaphoreGive(mutex_state_mutex);
+    } else {
+      s = get_state();
+    }
+    sink = s.outside_temp;
+    args->count++;
+  }
+  (void)sink;
+  xSemaphoreGive(args->done);
+  vTaskDelete(NULL);
+}
+
+static void writer_task(void* pvParameter) {
+  BenchmarkArgs* args = (BenchmarkArgs*)pvParameter;
+  while (*args->running) {
+    Temp16 t = args->count % 100;
+    if (args->use_mutex) {
+      xSemaphoreTake(mutex_state_mutex, portMAX_DELAY);
+      mutex_state.outside_temp = t;
+      xSemaphoreGive(mutex_state_mutex);
+    } else {
+      set_outside_temp(t);
+    }
+    args->count++;
+  }
+  xSemaphoreGive(args->done);
+  vTaskDelete(NULL);
+}
+
+// One writer on core 0 and a reader on each core, all at the same priority
+static void run_round(bool use_mutex) {
+  volatile bool running = true;
+  SemaphoreHandle_t done = xSemaphoreCreateCounting(3, 0);
+  BenchmarkArgs readers[2], writer;
+  for (int core = 0; core < 2; core++) {
+    readers[core] = (BenchmarkArgs){use_mutex, &running, done, 0};
+    xTaskCreatePinnedToCore(reader_task, "bench reader", BENCHMARK_STACK,
+                            &readers[core], tskIDLE_PRIORITY + 1, NULL, core);
+  }
+  writer = (BenchmarkArgs){use_mutex, &running, done, 0};
+  xTaskCreatePinnedToCore(writer_task, "bench writer", BENCHMARK_STACK,
+                          &writer, tskIDLE_PRIORITY + 1, NULL, 0);
+
+  vTaskDelay(pdMS_TO_TICKS(BENCHMARK_DURATION_US / 1000));
+  running = false;
+  for (int i = 0; i < 3; i++) {
+    xSemaphoreTake(done, portMAX_DELAY);
+  }
+  vSemaphoreDelete(done);
+
+  int seconds = BENCHMARK_DURATION_US / 1000000LL;
+  ESP_LOGI(TAG,
+           "%s: reads/s core 0 %lu, core 1 %lu; writes/s %lu",
+           use_mutex ? "mutex  " : "seqlock", readers[0].count / seconds,
+           readers[1].count / seconds, writer.count / seconds);
+}
+
+void run_state_benchmark() {
+  // The rounds write temperatures that were never measured
+  State saved = get_state();
+  mutex_state_mutex = xSemaphoreCreateMutex();
+  mutex_state = saved;
+
+  ESP_LOGI(TAG, "Running, %lld s per round", BENCHMARK_DURATION_US / 1000000LL);
+  run_round(true);
+  run_round(false);
+
+  vSemaphoreDelete(mutex_state_mutex);
+  // Leave State as it was before the rounds
+  set_state(&saved);
+}
@@ -0,0 +1,19 @@
+/*
+ * Measures State reader and writer throughput with tasks pinned to both
+ * cores, against a mutex protected copy for comparison. Enabled with
+ * CONFIG_STATE_BENCHMARK.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _STATE_BENCHMARK_H_
+#define _STATE_BENCHMARK_H_
+
+// Blocks for a few seconds and logs the results. Call after
+// initialize_state() and before the other tasks start.
+void run_state_benchmark();
+
+#endif  // _STATE_BENCHMARK_H_
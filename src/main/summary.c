@@ -0,0 +1,119 @@
+#include "summary.h"
+
+#include "clock.h"
+#include "constants.h"
+#include "esp_log.h"
+#include "eventlog.h"
+#include "flashlog.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char* TAG = "summary";
+
+// Only single rows are touched inside: short enough for a critical section
+static portMUX_TYPE summary_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static RollupRow hour_rows[SUMMARY_HOURS_CAPACITY];
+static RollupRow day_rows[SUMMARY_DAYS_CAPACITY];
+static Rollups rollups;
+
+void summary_init() {
+  rollup_tier_init(&rollups.hours, ROLLUP_HOUR_S, hour_rows,
+                   SUMMARY_HOURS_CAPACITY);
+  rollup_tier_init(&rollups.days, ROLLUP_DAY_S, day_rows,
+                   SUMMARY_DAYS_CAPACITY);
+}
+
+// Seconds since the epoch as if local time were UTC, so that periods are
+// cut on local hours and midnights
+static int64_t local_s(time_t wall_s) {
+  struct tm t;
+  localtime_r(&wall_s, &t);
+  int64_t y = t.tm_year + 1900 - 1;
+  int64_t days = y * 365 + y / 4 - y / 100 + y / 400 - 719162 + t.tm_yday;
+  return days * 86400 + t.tm_hour * 3600 + t.tm_min * 60 + t.tm_sec;
+}
+
+static void add_sample(time_t wall_s, int16_t raw) {
+  int64_t time_s = local_s(wall_s);
+  portENTER_CRITICAL(&summary_lock);
+  rollup_add_sample(&rollups, time_s, raw);
+  portEXIT_CRITICAL(&summary_lock);
+}
+
+static void add_relay_on(time_t wall_s, uint32_t seconds) {
+  int64_t start_s = local_s(wall_s);
+  portENTER_CRITICAL(&summary_lock);
+  rollup_add_relay_on(&rollups, start_s, seconds);
+  portEXIT_CRITICAL(&summary_lock);
+}
+
+void summary_add_sample(int64_t now_us, int16_t raw) {
+  if (!clock_wall_valid()) {
+    return;
+  }
+  add_sample(clock_to_wall_s(now_us), raw);
+}
+
+void summary_add_relay_on(int64_t start_us, int64_t width_us) {
+  if (!clock_wall_valid() || width_us <= 0) {
+    return;
+  }
+  add_relay_on(clock_to_wall_s(start_us), (width_us + 500000) / 1000000);
+}
+
+typedef struct {
+  uint32_t boot_s;
+  size_t samples;
+} Rebuild;
+
+// Records from before this boot. Later ones were added as they happened,
+// and ones from before the clock was set cannot be placed.
+static bool rebuild_record(const FlashLogHeader* h, const void* payload,
+                           void* ctx) {
+  Rebuild* r = ctx;
+  if (h->flags & FLASHLOG_FLAG_MONOTONIC) {
+    return true;
+  }
+  if (h->type == FLASHLOG_TYPE_TEMPERATURE_BLOCK) {
+    TempDecoder d;
+    flashlog_block_decoder(h, payload, &d);
+    uint32_t time_s;
+    int16_t raw;
+    while (temp_decode(&d, &time_s, &raw)) {
+      if (time_s < r->boot_s) {
+        add_sample(time_s, raw);
+        r->samples++;
+      }
+    }
+  } else if (h->type == EVENT_RELAY_OFF) {
+    const FlashLogEvent* e = payload;
+    if (e->time_s < r->boot_s && e->value > 0) {
+      add_relay_on(e->time_s - e->value, e->value);
+    }
+  }
+  return true;
+}
+
+void summary_rebuild_task() {
+  while (!clock_wall_valid()) {
+    vTaskDelay(SUMMARY_REBUILD_CHECK_TICKS);
+  }
+  int64_t start_us = clock_now_us();
+  Rebuild r = {.boot_s = clock_to_wall_s(0)};
+  flashlog_read_range(r.boot_s - SUMMARY_DAYS_CAPACITY * ROLLUP_DAY_S,
+                      r.boot_s, rebuild_record, &r);
+  ESP_LOGI(TAG, "Rebuilt from %u samples in flash in %lld ms",
+           (unsigned)r.samples, (clock_now_us() - start_us) / 1000);
+  vTaskDelete(NULL);
+}
+
+bool summary_get(SummaryTier tier, uint32_t age, RollupRow* row,
+                 int64_t* start_s) {
+  portENTER_CRITICAL(&summary_lock);
+  bool found = rollup_get(
+      tier == SUMMARY_DAYS ? &rollups.days : &rollups.hours, age, row,
+      start_s);
+  portEXIT_CRITICAL(&summary_lock);
+  return found;
+}
@@ -0,0 +1,39 @@
+/*
+ * The device's hourly and daily rollups, see rollup.h. Fed by the sampler
+ * and the relay; read by the HTTP server.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _SUMMARY_H_
+#define _SUMMARY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rollup.h"
+
+typedef enum {
+  SUMMARY_HOURS = 0,
+  SUMMARY_DAYS,
+} SummaryTier;
+
+void summary_init();
+
+// Times are monotonic. Periods are local (TZ) hours and days, so nothing
+// is recorded until the clock is set.
+void summary_add_sample(int64_t now_us, int16_t raw);
+void summary_add_relay_on(int64_t start_us, int64_t width_us);
+
+// Once the clock is set, adds what the flash log holds from before this
+// boot, so the rollups survive a reboot. Then exits.
+void summary_rebuild_task();
+
+// Copy of the row age periods before the newest, false past the oldest.
+// start_s is local time as if it were UTC: format it with gmtime_r().
+bool summary_get(SummaryTier, uint32_t age, RollupRow*, int64_t* start_s);
+
+#endif  // _SUMMARY_H_
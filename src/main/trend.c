@@ -0,0 +1,114 @@
+#include "trend.h"
+
+#include <string.h>
+
+// The sums are exact in int64 as long as x stays small: the origin moves up
+// to the oldest sample once the newest is TREND_REBASE_S past it, and no
+// sample is older than TREND_MAX_AGE_S, so x stays under 2^17. With 60
+// samples and |y| under 2^11 (the DS18B20's range) every product below is
+// far from overflowing.
+
+void trend_init(Trend* t) { memset(t, 0, sizeof(*t)); }
+
+static void add_sums(Trend* t, int64_t time_s, Temp16 value, int sign) {
+  int64_t x = time_s - t->origin_s;
+  t->sum_x += sign * x;
+  t->sum_y += sign * value;
+  t->sum_xx += sign * x * x;
+  t->sum_xy += sign * x * value;
+  t->sum_yy += sign * (int64_t)value * value;
+}
+
+// Moves x = 0 by d without touching the samples
+static void rebase(Trend* t, int64_t d) {
+  int64_t n = t->count;
+  t->sum_xx += -2 * d * t->sum_x + n * d * d;
+  t->sum_xy -= d * t->sum_y;
+  t->sum_x -= n * d;
+  t->origin_s += d;
+}
+
+static uint8_t oldest(const Trend* t) {
+  return (t->next + TREND_WINDOW - t->count) % TREND_WINDOW;
+}
+
+static void drop_oldest(Trend* t) {
+  uint8_t i = oldest(t);
+  add_sums(t, t->time_s[i], t->value[i], -1);
+  t->count--;
+}
+
+void trend_add(Trend* t, int64_t time_s, Temp16 value) {
+  while (t->count &&
+         (t->count == TREND_WINDOW ||
+          time_s - t->time_s[oldest(t)] > TREND_MAX_AGE_S)) {
+    drop_oldest(t);
+  }
+  if (t->count == 0) {
+    t->origin_s = time_s;
+  }
+  t->time_s[t->next] = time_s;
+  t->value[t->next] = value;
+  t->next = (t->next + 1) % TREND_WINDOW;
+  t->count++;
+  add_sums(t, time_s, value, 1);
+
+  if (time_s - t->origin_s > TREND_REBASE_S) {
+    rebase(t, t->time_s[oldest(t)] - t->origin_s);
+  }
+}
+
+// r2 = sxy^2 / (sxx * syy) in percent, in integers. sxx and syy are
+// quartered and sxy halved, which keeps the ratio, until the products fit
+// in int64; both keep at least 26 bits.
+static uint8_t r2_pct(int64_t sxy, int64_t sxx, int64_t syy) {
+  if (syy <= 0) {
+    return 0;
+  }
+  while (sxx >= (1 << 28)) {
+    sxx /= 4;
+    sxy /= 2;
+  }
+  while (syy >= (1 << 28)) {
+    syy /= 4;
+    sxy /= 2;
+  }
+  int64_t pct = 100 * sxy * sxy / (sxx * syy);
+  return pct < 100 ? pct : 100;
+}
+
+static Temp16 clamp_temp(int64_t v) {
+  return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+}
+
+TrendEstimate trend_estimate(const Trend* t, int64_t now_s, Temp16 threshold) {
+  TrendEstimate e = {.samples = t->count, .cross_s = TREND_NEVER};
+  int64_t n = t->count;
+  // n times the centred sums, to stay in integers
+  int64_t sxx = n * t->sum_xx - t->sum_x * t->sum_x;
+  int64_t sxy = n * t->sum_xy - t->sum_x * t->sum_y;
+  int64_t syy = n * t->sum_yy - t->sum_y * t->sum_y;
+  if (n < 2 || sxx == 0) {
+    e.now = n ? clamp_temp(t->sum_y / n) : 0;
+    e.slope_per_hour = 0;
+    return e;
+  }
+
+  e.slope_per_hour = sxy * 3600 / sxx;
+  e.r2_pct = r2_pct(sxy, sxx, syy);
+  // y(x) = mean y + slope * (x - mean x)
+  int64_t x = now_s - t->origin_s;
+  e.now = clamp_temp((t->sum_y * sxx + sxy * (n * x - t->sum_x)) / (n * sxx));
+
+  if (e.now <= threshold) {
+    e.cross_s = 0;
+  } else if (sxy < 0) {
+    int64_t cross_s = (int64_t)(threshold - e.now) * sxx / sxy;
+    e.cross_s = cross_s < TREND_NEVER ? cross_s : TREND_NEVER;
+  }
+  return e;
+}
+
+Temp16 trend_project(const TrendEstimate* e, int32_t ahead_s) {
+  return clamp_temp(e->now + (int64_t)e->slope_per_hour * ahead_s / 3600);
+}
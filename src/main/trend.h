@@ -0,0 +1,55 @@
+/*
+ * Rolling least squares line through the last TREND_WINDOW temperatures,
+ * updated in O(1) per sample from running sums. Says whether it is getting
+ * colder, how sure that is, and when the freeze threshold will be crossed.
+ * Pure C, no FreeRTOS, so it can also be built on a host.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#ifndef _TREND_H_
+#define _TREND_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "sample.h"
+
+#define TREND_NEVER INT32_MAX
+
+typedef struct {
+  int64_t time_s[TREND_WINDOW];  // Arrival order, a ring
+  Temp16 value[TREND_WINDOW];
+  uint8_t next;
+  uint8_t count;
+  // Sums over the window, with x = time_s - origin_s and y = value
+  int64_t origin_s;
+  int64_t sum_x;
+  int64_t sum_y;
+  int64_t sum_xx;
+  int64_t sum_xy;
+  int64_t sum_yy;
+} Trend;
+
+typedef struct {
+  uint8_t samples;
+  int32_t slope_per_hour;  // 1/16 C an hour, negative when getting colder
+  uint8_t r2_pct;  // How much of the variation the line explains, 0-100
+  Temp16 now;   // The line at the time asked about
+  int32_t cross_s;  // Until the line reaches the threshold: 0 if it already
+                    // has, TREND_NEVER if it is moving away
+} TrendEstimate;
+
+void trend_init(Trend*);
+// Times are seconds on any clock that does not jump, e.g. since boot
+void trend_add(Trend*, int64_t time_s, Temp16);
+TrendEstimate trend_estimate(const Trend*, int64_t now_s, Temp16 threshold);
+
+// The line ahead_s after the estimate, clamped to what Temp16 holds
+Temp16 trend_project(const TrendEstimate*, int32_t ahead_s);
+
+#endif  // _TREND_H_
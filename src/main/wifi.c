@@ -53,7 +53,7 @@ static void event_handler(void* arg, esp_event_base_t event_base,
   }
 }
 
-void wifi_init_sta(void) {
+bool wifi_init_sta(void) {
   s_wifi_event_group = xEventGroupCreate();
 
   ESP_ERROR_CHECK(esp_netif_init());
@@ -101,9 +101,11 @@ void wifi_init_sta(void) {
    * can test which event actually happened. */
   if (bits & WIFI_CONNECTED_BIT) {
     ESP_LOGI(TAG, "connected to ap SSID:%s", CONFIG_WIFI_SSID);
+    return true;
   } else if (bits & WIFI_FAIL_BIT) {
-    ESP_LOGI(TAG, "connected to ap SSID:%s", CONFIG_WIFI_SSID);
+    ESP_LOGI(TAG, "Failed to connect to SSID:%s", CONFIG_WIFI_SSID);
   } else {
     ESP_LOGE(TAG, "UNEXPECTED EVENT");
   }
+  return false;
 }
\ No newline at end of file
@@ -13,6 +13,9 @@
 #ifndef _WIFI_H_
 #define _WIFI_H_
 
-void wifi_init_sta();
+#include <stdbool.h>
+
+// Blocks until connected or the retries run out. True if connected.
+bool wifi_init_sta();
 
 #endif
\ No newline at end of file
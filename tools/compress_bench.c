@@ -0,0 +1,191 @@
+/*
+ * Measures the temperature compression (src/main/compress.c) on synthetic
+ * traces, and on recorded ones given as files of "unix_time,temp_c" lines
+ * (e.g. from a logger, or the device's /log reformatted).
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compress.h"
+
+// As in flashlog.c: a block fills the rest of a 256 byte page after an 8
+// byte record and block header, or is closed by the hourly flush
+// (FLASHLOG_MAX_DELAY_US) first, which at one sample a minute comes well
+// before the page fills
+#define BLOCK_BYTES 248
+#define BLOCK_OVERHEAD 8
+#define FLUSH_S (60 * 60)
+// One sample uncompressed: 4 byte time and 2 byte value, or an 8 byte
+// flash log event record plus its 4 byte header
+#define PACKED_BYTES 6
+#define RECORD_BYTES 12
+#define RAW_PER_C 16
+#define MAX_SAMPLES (1 << 20)
+
+typedef struct {
+  uint32_t time_s;
+  int16_t raw;
+} Sample;
+
+static Sample samples[MAX_SAMPLES];
+static Sample decoded[MAX_SAMPLES];
+// Blocks packed end to end. A sample takes at most 7 bytes, so a short
+// block never uses more than its samples' share.
+static uint8_t blocks[MAX_SAMPLES * 7 + BLOCK_BYTES];
+static size_t block_offsets[MAX_SAMPLES];
+static uint16_t block_counts[MAX_SAMPLES];
+
+static double now_s() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Gaussian noise, for a probe's ~0.1 C jitter
+static double noise(double sigma) {
+  double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+  double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+  return sigma * sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static int16_t to_raw(double temp_c) {
+  return (int16_t)lround(temp_c * RAW_PER_C);
+}
+
+// A winter week at one minute: daily swing, a passing front, probe noise
+// and the odd second of sampling jitter
+static size_t winter(Sample* s, double noise_c) {
+  size_t n = 7 * 24 * 60;
+  uint32_t t = 1704067200;
+  for (size_t i = 0; i < n; i++) {
+    double day = i / (24.0 * 60);
+    double temp_c = -4 + 5 * sin(2 * M_PI * (day - 0.3)) -
+                    6 * exp(-pow(day - 3.5, 2)) + noise(noise_c);
+    t += 60 + (rand() % 50 == 0 ? rand() % 3 - 1 : 0);
+    s[i] = (Sample){t, to_raw(temp_c)};
+  }
+  return n;
+}
+
+// The same with the probe unplugged now and then: gaps in the timestamps
+static size_t gappy(Sample* s) {
+  size_t n = winter(s, 0.05);
+  uint32_t shift = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (rand() % 500 == 0) {
+      shift += 60 * (1 + rand() % 120);
+    }
+    s[i].time_s += shift;
+  }
+  return n;
+}
+
+static size_t load(const char* path, Sample* s) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    return 0;
+  }
+  char line[128];
+  size_t n = 0;
+  while (n < MAX_SAMPLES && fgets(line, sizeof(line), f)) {
+    double time_s, temp_c;
+    if (sscanf(line, "%lf%*[ ,\t]%lf", &time_s, &temp_c) == 2) {
+      s[n++] = (Sample){(uint32_t)time_s, to_raw(temp_c)};
+    }
+  }
+  fclose(f);
+  return n;
+}
+
+static void bench(const char* name, const Sample* s, size_t n) {
+  if (n == 0) {
+    return;
+  }
+  // Several rounds so the timing means something for small traces
+  int rounds = 1 + 1000000 / n;
+  size_t block_count = 0;
+  size_t bytes = 0;
+  double start = now_s();
+  for (int r = 0; r < rounds; r++) {
+    TempEncoder e;
+    block_count = 0;
+    bytes = 0;
+    size_t offset = 0;
+    temp_encoder_init(&e, blocks, BLOCK_BYTES);
+    uint32_t flush_s = s[0].time_s + FLUSH_S;
+    for (size_t i = 0; i < n; i++) {
+      bool flush = s[i].time_s >= flush_s;
+      if (flush) {
+        flush_s = s[i].time_s + FLUSH_S;
+      }
+      if (flush || !temp_encode(&e, s[i].time_s, s[i].raw)) {
+        block_offsets[block_count] = offset;
+        block_counts[block_count] = e.count;
+        bytes += BLOCK_OVERHEAD + temp_encoder_bytes(&e);
+        offset += temp_encoder_bytes(&e);
+        block_count++;
+        temp_encoder_init(&e, blocks + offset, BLOCK_BYTES);
+        temp_encode(&e, s[i].time_s, s[i].raw);
+      }
+    }
+    block_offsets[block_count] = offset;
+    block_counts[block_count] = e.count;
+    bytes += BLOCK_OVERHEAD + temp_encoder_bytes(&e);
+    block_count++;
+  }
+  double encode_s = (now_s() - start) / rounds;
+
+  size_t m = 0;
+  start = now_s();
+  for (int r = 0; r < rounds; r++) {
+    m = 0;
+    for (size_t b = 0; b < block_count; b++) {
+      TempDecoder d;
+      temp_decoder_init(&d, blocks + block_offsets[b], BLOCK_BYTES,
+                        block_counts[b]);
+      while (temp_decode(&d, &decoded[m].time_s, &decoded[m].raw)) {
+        m++;
+      }
+    }
+  }
+  double decode_s = (now_s() - start) / rounds;
+
+  size_t mismatches = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (i >= m || decoded[i].time_s != s[i].time_s ||
+        decoded[i].raw != s[i].raw) {
+      mismatches++;
+    }
+  }
+  printf("%-18s %8zu %6zu %8zu %6.2f %7.1fx %7.1fx %8.1f %8.1f %s\n", name, n,
+         block_count, bytes, 8.0 * bytes / n,
+         (double)n * PACKED_BYTES / bytes, (double)n * RECORD_BYTES / bytes,
+         encode_s * 1e9 / n, decode_s * 1e9 / n,
+         mismatches ? "MISMATCH" : "ok");
+}
+
+int main(int argc, char** argv) {
+  srand(1);
+  printf("%-18s %8s %6s %8s %6s %8s %8s %8s %8s\n", "trace", "samples",
+         "blocks", "bytes", "bits", "vs 6 B", "vs rec", "enc ns", "dec ns");
+  bench("winter", samples, winter(samples, 0.05));
+  bench("winter, noisy", samples, winter(samples, 0.3));
+  bench("winter, gaps", samples, gappy(samples));
+  for (int i = 1; i < argc; i++) {
+    const char* name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1
+                                             : argv[i];
+    bench(name, samples, load(argv[i], samples));
+  }
+  return 0;
+}
@@ -0,0 +1,289 @@
+/*
+ * Replays temperature traces through the device's control policies
+ * (src/main/policy.c, with trend.c and exposure.c fed as main.c feeds them)
+ * on a virtual clock, so a policy or parameter change can be judged over a
+ * whole winter in seconds. Traces are synthetic, or recorded ones given as
+ * files of "unix_time,temp_c" lines.
+ *
+ *   ./replay [-p policy] [-t threshold_c] [-s name=value ...] [trace ...]
+ *
+ * Without -p every policy is run. -s sets a policy parameter, as at
+ * /policy on the device.
+ * Part of the Antifreeze program. https://github.com/kghose/antifreeze
+ *
+ * (c) 2024 Kaushik Ghose
+ *
+ * Released under the MIT License
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "exposure.h"
+#include "policy.h"
+#include "trend.h"
+
+#define MAX_SAMPLES (1 << 20)
+#define MAX_ROUNDS 64
+
+typedef struct {
+  uint32_t time_s;
+  Temp16 temp;
+} TraceSample;
+
+typedef struct {
+  uint32_t starts;
+  int64_t run_us;
+  int64_t longest_gap_us;  // Below the threshold without circulation
+  int64_t span_us;
+} Result;
+
+static TraceSample samples[MAX_SAMPLES];
+
+static double now_s() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Gaussian noise, for a probe's ~0.1 C jitter
+static double noise(double sigma) {
+  double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+  double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+  return sigma * sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static Temp16 to_temp(double temp_c) {
+  return (Temp16)lround(temp_c * SAMPLE_RAW_PER_C);
+}
+
+// A winter at one minute, December to March: the season's curve around
+// mean_c, a daily swing, a cold front every week or so and probe noise
+static size_t season(TraceSample* s, double mean_c, double swing_c) {
+  size_t n = 120 * 24 * 60;
+  uint32_t t = 1701388800;  // 2023-12-01
+  double front_day = 3 + rand() % 7;
+  double front_c = 0;
+  for (size_t i = 0; i < n; i++) {
+    double day = i / (24.0 * 60);
+    if (day > front_day + 3) {
+      front_day += 4 + rand() % 8;
+      front_c = 3 + rand() % 8;
+    }
+    double temp_c = mean_c - 3 * sin(M_PI * day / 120) +
+                    swing_c * sin(2 * M_PI * (day - 0.3)) -
+                    front_c * exp(-pow(day - front_day, 2)) + noise(0.1);
+    s[i] = (TraceSample){t, to_temp(temp_c)};
+    t += 60;
+  }
+  return n;
+}
+
+static size_t load(const char* path, TraceSample* s) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    return 0;
+  }
+  char line[128];
+  size_t n = 0;
+  while (n < MAX_SAMPLES && fgets(line, sizeof(line), f)) {
+    double time_s, temp_c;
+    if (sscanf(line, "%lf%*[ ,\t]%lf", &time_s, &temp_c) == 2) {
+      s[n++] = (TraceSample){(uint32_t)time_s, to_temp(temp_c)};
+    }
+  }
+  fclose(f);
+  return n;
+}
+
+// The device's sample loop and relay scheduler on a virtual clock. Each
+// sample updates the trend and exposure and the policy is asked again, as
+// State notifications do on the device; a run that falls due before the
+// next sample starts at its time, or once the relay is off.
+static Result replay(const PolicyConfig* policy, Temp16 threshold,
+                     const TraceSample* s, size_t n) {
+  static Trend trend;
+  Exposure exposure;
+  trend_init(&trend);
+  exposure_init(&exposure, 0);
+  Result r = {0};
+  int64_t last_run_us = CLOCK_NEVER_US;
+  int64_t relay_off_us = 0;
+  int64_t below_since_us = -1;
+  for (size_t i = 0; i < n; i++) {
+    int64_t t_s = (int64_t)s[i].time_s - s[0].time_s;
+    int64_t now_us = t_s * 1000000LL;
+    int64_t next_sample_us =
+        i + 1 < n ? ((int64_t)s[i + 1].time_s - s[0].time_s) * 1000000LL
+                  : now_us + TEMP_SAMPLE_PERIOD_US;
+    trend_add(&trend, t_s, s[i].temp);
+    exposure_add(&exposure, t_s, s[i].temp, threshold,
+                 policy->params.exposure_decay_s);
+
+    bool below = s[i].temp < threshold;
+    if (below && below_since_us < 0) {
+      below_since_us = now_us;
+    } else if (!below) {
+      below_since_us = -1;
+    }
+
+    PolicyInputs inputs = {
+        .temp = s[i].temp,
+        .temp_stale = next_sample_us - now_us > TEMP_SAMPLE_STALE_US,
+        .threshold = threshold,
+        .trend = trend_estimate(&trend, t_s, threshold),
+        .exposure = exposure_get(&exposure),
+    };
+    while (true) {
+      inputs.last_run_us = last_run_us;
+      PolicyDecision d = policy_decide(policy, &inputs);
+      if (d.next_run_us == THE_END_OF_TIME) {
+        break;
+      }
+      int64_t start_us = d.next_run_us;
+      start_us = start_us > now_us ? start_us : now_us;
+      start_us = start_us > relay_off_us ? start_us : relay_off_us;
+      if (start_us >= next_sample_us) {
+        break;
+      }
+      if (below_since_us >= 0) {
+        int64_t from_us =
+            below_since_us > relay_off_us ? below_since_us : relay_off_us;
+        if (start_us - from_us > r.longest_gap_us) {
+          r.longest_gap_us = start_us - from_us;
+        }
+      }
+      r.starts++;
+      r.run_us += d.run_us;
+      last_run_us = start_us;
+      relay_off_us = start_us + d.run_us;
+    }
+
+    if (below_since_us >= 0) {
+      int64_t from_us =
+          below_since_us > relay_off_us ? below_since_us : relay_off_us;
+      if (next_sample_us - from_us > r.longest_gap_us) {
+        r.longest_gap_us = next_sample_us - from_us;
+      }
+    }
+    r.span_us = next_sample_us;
+  }
+  return r;
+}
+
+static void run(const char* name, const PolicyConfig* policy,
+                Temp16 threshold, const TraceSample* s, size_t n) {
+  if (n == 0) {
+    return;
+  }
+  // Several rounds so the timing means something for short traces
+  int rounds = 1 + 2000000 / n;
+  rounds = rounds < MAX_ROUNDS ? rounds : MAX_ROUNDS;
+  Result r;
+  double start = now_s();
+  for (int i = 0; i < rounds; i++) {
+    r = replay(policy, threshold, s, n);
+  }
+  double elapsed_s = (now_s() - start) / rounds;
+  double days = r.span_us / (86400 * 1e6);
+  printf("%-18s %-10s %6.1f %7u %9.0f %8.0f %10.0f\n", name,
+         policy_name(policy->id), days, r.starts, r.run_us / 60e6,
+         r.longest_gap_us / 60e6, days / elapsed_s);
+}
+
+static void run_all(const char* name, const PolicyConfig* policy, bool all,
+                    Temp16 threshold, const TraceSample* s, size_t n) {
+  if (!all) {
+    run(name, policy, threshold, s, n);
+    return;
+  }
+  PolicyConfig each = *policy;
+  for (int id = 0; id < POLICY_COUNT; id++) {
+    each.id = id;
+    run(name, &each, threshold, s, n);
+  }
+}
+
+static bool set_param(PolicyParams* params, char* arg) {
+  char* value = strchr(arg, '=');
+  if (value == NULL) {
+    return false;
+  }
+  *value++ = '\0';
+  for (int i = 0; i < policy_param_count; i++) {
+    if (strcmp(arg, policy_param_info[i].name) == 0) {
+      return policy_param_set(params, &policy_param_info[i], value);
+    }
+  }
+  return false;
+}
+
+static void usage(const char* argv0) {
+  fprintf(stderr,
+          "usage: %s [-p policy] [-t threshold_c] [-s name=value ...] "
+          "[trace ...]\nparameters:",
+          argv0);
+  for (int i = 0; i < policy_param_count; i++) {
+    fprintf(stderr, " %s", policy_param_info[i].name);
+  }
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+  PolicyConfig policy;
+  policy_defaults(&policy);
+  bool all = true;
+  Temp16 threshold = TEMP16_FROM_C(DEFAULT_FREEZE_DANGER_TEMP_C);
+  int opt;
+  while ((opt = getopt(argc, argv, "p:t:s:")) != -1) {
+    switch (opt) {
+      case 'p':
+        if (!policy_from_name(optarg, &policy.id)) {
+          fprintf(stderr, "Unknown policy %s\n", optarg);
+          return 1;
+        }
+        all = false;
+        break;
+      case 't':
+        threshold = to_temp(atof(optarg));
+        break;
+      case 's':
+        if (!set_param(&policy.params, optarg)) {
+          fprintf(stderr, "Bad parameter %s\n", optarg);
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  const char* invalid = policy_invalid(&policy);
+  if (invalid != NULL) {
+    fprintf(stderr, "Policy not valid: %s\n", invalid);
+    return 1;
+  }
+
+  srand(1);
+  printf("%-18s %-10s %6s %7s %9s %8s %10s\n", "trace", "policy", "days",
+         "starts", "circ min", "gap min", "days/s");
+  if (optind == argc) {
+    run_all("winter, cold", &policy, all, threshold, samples,
+            season(samples, -4, 5));
+    run_all("winter, mild", &policy, all, threshold, samples,
+            season(samples, 2, 4));
+  }
+  for (int i = optind; i < argc; i++) {
+    const char* name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1
+                                             : argv[i];
+    run_all(name, &policy, all, threshold, samples, load(argv[i], samples));
+  }
+  return 0;
+}